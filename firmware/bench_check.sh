@@ -0,0 +1,60 @@
+#!/bin/bash
+
+# Evaluate the benchmark reports of a BENCH build (see bench.h) on the debug console.
+# Usage: bench_check.sh <console port> [number of reports]
+# Prints the console output, and exits with status 1 if any report is over budget, or 2 if
+# no report arrives in time (e.g. not a BENCH build, or the board is not running).
+
+CONSOLE_PORT=$1
+REPORTS=${2:-5}
+BAUD=115200
+REPORT_TIMEOUT=90   # seconds; reports come every BENCH_REPORT_INTERVAL (60 s)
+
+if [ -z "$CONSOLE_PORT" ]; then
+    echo "Usage: $0 <console port> [number of reports]"
+    exit 2
+fi
+
+# Configure the serial port (BSD stty on macOS takes -f, GNU stty on Linux -F)
+if [ "$(uname)" = "Darwin" ]; then
+    stty -f "$CONSOLE_PORT" $BAUD raw -echo
+else
+    stty -F "$CONSOLE_PORT" $BAUD raw -echo
+fi
+if [ $? -ne 0 ]; then
+    echo "Error: Failed to open $CONSOLE_PORT"
+    exit 2
+fi
+
+exec 3< "$CONSOLE_PORT"
+
+received=0
+failed=0
+deadline=$((SECONDS + REPORT_TIMEOUT))
+while [ $received -lt "$REPORTS" ]; do
+    remaining=$((deadline - SECONDS))
+    if [ $remaining -le 0 ] || ! IFS= read -r -t $remaining line <&3; then
+        echo "Error: No benchmark report received within $REPORT_TIMEOUT s"
+        exit 2
+    fi
+    line=${line%$'\r'}
+    echo "$line"
+    case "$line" in
+        "BENCH: PASS"*)
+            received=$((received + 1))
+            deadline=$((SECONDS + REPORT_TIMEOUT))
+            ;;
+        "BENCH: FAIL"*)
+            received=$((received + 1))
+            failed=$((failed + 1))
+            deadline=$((SECONDS + REPORT_TIMEOUT))
+            ;;
+    esac
+done
+
+echo ""
+if [ $failed -gt 0 ]; then
+    echo "$failed of $received benchmark reports over budget"
+    exit 1
+fi
+echo "All $received benchmark reports within budget"
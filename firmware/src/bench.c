@@ -0,0 +1,77 @@
+/*
+ * Statistics for power benchmarking on the real hardware: number of wakeups, CPU cycles
+ * awake per wakeup and the awake duty cycle, plus the worst-case RTC SPI response latency.
+ * A report is printed to the debug console every BENCH_REPORT_INTERVAL, followed by a PASS or
+ * FAIL line listing the values over budget, which bench_check.sh evaluates. Note that the debug
+ * output itself adds some awake time.
+ *
+ * Peripherals used: TCB1 (stops in standby, so it only counts cycles while awake)
+ */
+#ifdef BENCH
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "bench.h"
+#include "rtc.h"
+#include "debug.h"
+
+static volatile uint16_t awake_overflows;
+static uint32_t report_ticks;       // 32 bits, as the interval may exceed the 64 s range of 16-bit ticks
+static uint16_t wakes;
+static uint32_t awake_cycles;
+static uint32_t max_awake_cycles;
+
+void bench_init(void) {
+    TCB1.CCMP = 0xFFFF;
+    TCB1.INTCTRL = TCB_CAPT_bm;
+    TCB1.CTRLA = TCB_CLKSEL_DIV1_gc | TCB_ENABLE_bm;
+    report_ticks = rtc_get_ticks32();
+}
+
+void bench_before_sleep(void) {
+    uint32_t cycles = ((uint32_t)awake_overflows << 16) | TCB1.CNT;
+    awake_cycles += cycles;
+    if (cycles > max_awake_cycles) {
+        max_awake_cycles = cycles;
+    }
+}
+
+void bench_after_wake(void) {
+    TCB1.CNT = 0;
+    awake_overflows = 0;
+    wakes++;
+
+    uint32_t elapsed = rtc_get_ticks32() - report_ticks;
+    if (elapsed < BENCH_REPORT_INTERVAL * 1024UL) {
+        return;
+    }
+    report_ticks += elapsed;
+
+    // Awake cycles relative to total cycles in interval
+    uint32_t duty = awake_cycles / (elapsed * (F_CPU / 1024) / 1000);
+    uint16_t spi_cycles = rtc_get_max_response_cycles();
+    debug_printf("BENCH: %u wakes, max %lu cycles/wake, duty %lu/1000, SPI %u cycles\n",
+                 wakes, max_awake_cycles, duty, spi_cycles);
+    if (wakes > BENCH_BUDGET_WAKES || max_awake_cycles > BENCH_BUDGET_AWAKE_CYCLES ||
+        duty > BENCH_BUDGET_DUTY_PERMILLE || spi_cycles > BENCH_BUDGET_SPI_CYCLES) {
+        debug_printf("BENCH: FAIL%s%s%s%s\n",
+                     wakes > BENCH_BUDGET_WAKES ? " wakes" : "",
+                     max_awake_cycles > BENCH_BUDGET_AWAKE_CYCLES ? " cycles/wake" : "",
+                     duty > BENCH_BUDGET_DUTY_PERMILLE ? " duty" : "",
+                     spi_cycles > BENCH_BUDGET_SPI_CYCLES ? " SPI" : "");
+    } else {
+        debug_printf("BENCH: PASS\n");
+    }
+
+    wakes = 0;
+    awake_cycles = 0;
+    max_awake_cycles = 0;
+}
+
+ISR(TCB1_INT_vect) {
+    TCB1.INTFLAGS = TCB_CAPT_bm;
+    awake_overflows++;
+}
+
+#endif
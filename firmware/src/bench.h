@@ -0,0 +1,16 @@
+/* Wake/awake time statistics for power benchmarking (only built with BENCH=1) */
+#pragma once
+
+#include <stdint.h>
+
+#define BENCH_REPORT_INTERVAL       60      // s
+#define BENCH_BUDGET_WAKES          30      // max. wakes per report interval
+#define BENCH_BUDGET_AWAKE_CYCLES   20000   // max. CPU cycles awake per wake (1 ms)
+#define BENCH_BUDGET_DUTY_PERMILLE  5       // max. awake time in 1/1000 of total time
+#define BENCH_BUDGET_SPI_CYCLES     200     // max. RTC SPI response latency (10 µs)
+
+void bench_init(void);
+
+// Call right before entering sleep and right after waking up (and servicing the wakeup interrupt)
+void bench_before_sleep(void);
+void bench_after_wake(void);
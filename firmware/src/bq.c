@@ -1,5 +1,6 @@
 #include "bq.h"
 #include "debug.h"
+#include "telemetry.h"
 #include <avr/io.h>
 #include <util/delay.h>
 
@@ -11,9 +12,33 @@ static bool bq_write_register(uint8_t reg, uint8_t value);
 static bool bq_write_register16(uint8_t reg, uint16_t value);
 static bool bq_set_register_bit(uint8_t reg, uint8_t bitmask, bool set);
 
+static void bq_init_pins(void);
+static uint8_t bq_cell_config(uint16_t charging_voltage_limit);
+
 static bool bq_read_error = false;
 static volatile bool bq_interrupt_pending = false;
 
+// Configuration registers that are only written by bq_init(), with the bits that are not
+// changed during operation (for verification after a warm reset)
+static const struct {
+    uint8_t reg;
+    uint8_t value;
+    uint8_t mask;
+} bq_static_config[] = {
+    { 0x00, 0x1A, 0xFF },
+    { 0x08, 0x85, 0xFF },
+    { 0x0F, 0x92, 0xDF },   // except EN_CHG
+    { 0x10, 0x00, 0xFF },
+    { 0x11, 0xF8, 0x38 },   // except FORCE_INDET, AUTO_INDET_EN
+    { 0x12, 0x34, 0x8F },   // except EN_OTG, PFM_OTG_DIS, PFM_FWD_DIS
+    { 0x13, 0x15, 0x1F },   // except ACDRV2, ACDRV1, PWM_FREQ
+    { 0x14, 0x14, 0xFF },
+    { 0x28, 0xF9, 0xFF },
+    { 0x29, 0x7F, 0xFF },
+    { 0x2A, 0x7F, 0xFF },
+    { 0x2B, 0x10, 0xFF },
+};
+
 static uint8_t bq_read_register(uint8_t reg) {
     uint8_t data;
     if (twi_send_and_read_bytes(BQ_ADDR, reg, &data, 1)) {
@@ -52,9 +77,7 @@ static bool bq_set_register_bit(uint8_t reg, uint8_t bitmask, bool set) {
     return bq_write_register(reg, value);
 }
 
-bool bq_init(uint16_t charging_voltage_limit, uint16_t charging_current_limit) {
-    bool success = true;
-
+static void bq_init_pins(void) {
     // Configure BQ_INT pin
     PORTA.PIN6CTRL = PORT_INVEN_bm | PORT_PULLUPEN_bm;
 
@@ -62,6 +85,25 @@ bool bq_init(uint16_t charging_voltage_limit, uint16_t charging_current_limit) {
     PORTA.DIRSET = PIN7_bm;
     PORTA.OUTSET = PIN7_bm;
     PORTA.PIN7CTRL = PORT_INVEN_bm;
+}
+
+// Returns the value for REG0A, or 0 if the charging voltage limit is not supported
+static uint8_t bq_cell_config(uint16_t charging_voltage_limit) {
+    uint8_t cell = 3;
+    if (charging_voltage_limit >= 14000 && charging_voltage_limit <= 18800) {
+        // Must set CELL = 4 for voltages above 14 V
+        cell = 4;
+    } else if (charging_voltage_limit < 10000) {
+        // Not supported
+        return 0;
+    }
+    return (cell - 1) << 6 | 0x23;
+}
+
+bool bq_init(uint16_t charging_voltage_limit, uint16_t charging_current_limit) {
+    bool success = true;
+
+    bq_init_pins();
 
     // Reset to defaults
     success &= bq_write_register(0x09, 0x45);
@@ -73,15 +115,11 @@ bool bq_init(uint16_t charging_voltage_limit, uint16_t charging_current_limit) {
     // Set up registers according to our needs. The comments below only reflect deviations from the POR defaults.
 
     // REG0A (set first as it will reset the registers below): Cell count
-    uint8_t cell = 3;
-    if (charging_voltage_limit >= 14000 && charging_voltage_limit <= 18800) {
-        // Must set CELL = 4 for voltages above 14 V
-        cell = 4;
-    } else if (charging_voltage_limit < 10000) {
-        // Not supported
+    uint8_t reg0a = bq_cell_config(charging_voltage_limit);
+    if (reg0a == 0) {
         return false;
     }
-    success &= bq_write_register(0x0A, (cell - 1) << 6 | 0x23);
+    success &= bq_write_register(0x0A, reg0a);
 
     // REG00: Minimal system voltage (VSYSMIN): 9 V
     success &= bq_write_register(0x00, 0x1A);
@@ -159,6 +197,35 @@ bool bq_init(uint16_t charging_voltage_limit, uint16_t charging_current_limit) {
     return success;
 }
 
+bool bq_resume(uint16_t charging_voltage_limit, uint16_t charging_current_limit) {
+    bq_init_pins();
+
+    uint8_t reg0a = bq_cell_config(charging_voltage_limit);
+    bq_read_error = false;
+    bool match = reg0a != 0 && bq_read_register(0x0A) == reg0a &&
+        bq_read_register16(0x01) == charging_voltage_limit / 10;
+    for (uint8_t i = 0; match && i < sizeof(bq_static_config) / sizeof(bq_static_config[0]); i++) {
+        uint8_t value = bq_read_register(bq_static_config[i].reg);
+        match = ((value ^ bq_static_config[i].value) & bq_static_config[i].mask) == 0;
+    }
+    if (!match || bq_read_error) {
+        debug_printf("BQ config mismatch\n");
+        return false;
+    }
+
+    // Thermal derating and the efficiency governor start over after a reset, so bring the
+    // settings they adjust back to the bq_init() defaults: ICHG, PFM disabled, 1.5 MHz
+    if (!bq_set_charge_current_limit(charging_current_limit) || !bq_set_converter_mode(false, false)) {
+        return false;
+    }
+
+    // Enable BQ_INT interrupts, and process any status changes that happened during the reset
+    PORTA.PIN6CTRL |= PORT_ISC_RISING_gc;
+    bq_interrupt_pending = true;
+
+    return true;
+}
+
 bool bq_test_connection(void) {
     uint8_t part_info = bq_read_register(0x48);
     if (bq_read_error || (part_info & 0x3F) != 0x08) {
@@ -212,13 +279,11 @@ bool bq_disable_bc12_detection(void) {
 bool bq_enable_otg(uint16_t votg) {
     bool success = true;
 
-    if (votg < 2800 || votg > 22000) {
+    // Set output voltage (VOTG)
+    if (!bq_set_otg_voltage(votg)) {
         return false;
     }
 
-    // Set output voltage (VOTG)
-    success &= bq_write_register16(0x0B, (votg - 2800) / 10);
-
     // USB DCP: short-circuit D+ and D- (1.5 A)
     success &= bq_write_register(0x47, 0xE0);
 
@@ -246,6 +311,14 @@ bool bq_disable_otg(void) {
     return success;
 }
 
+bool bq_set_otg_voltage(uint16_t votg) {
+    // REG0B: OTG mode regulation voltage (VOTG)
+    if (votg < 2800 || votg > 22000) {
+        return false;
+    }
+    return bq_write_register16(0x0B, (votg - 2800) / 10);
+}
+
 bool bq_set_acdrv(bool enable_acdrv1, bool enable_acdrv2) {
     uint8_t reg = bq_read_register(0x13);
     if (enable_acdrv1) {
@@ -270,6 +343,14 @@ bool bq_set_otg_current_limit(uint16_t ma) {
     return bq_write_register(0x0D, ma / 40);
 }
 
+bool bq_set_charge_current_limit(uint16_t ma) {
+    // REG03: Charge current limit (ICHG)
+    if (ma < 50 || ma > 5000) {
+        return false;
+    }
+    return bq_write_register16(0x03, ma / 10);
+}
+
 bool bq_set_input_current_limit(uint16_t ma) {
     // REG06: Input current limit (IINDPM)
     if (ma < 100 || ma > 3300) {
@@ -287,6 +368,18 @@ bool bq_set_thermistor(bool enable) {
     return bq_set_register_bit(0x18, 0x01, !enable);
 }
 
+bool bq_set_converter_mode(bool enable_pfm, bool low_frequency) {
+    bool success = true;
+
+    // REG12: PFM_OTG_DIS, PFM_FWD_DIS
+    success &= bq_set_register_bit(0x12, 0x30, !enable_pfm);
+
+    // REG13: PWM_FREQ (0 = 1.5 MHz, 1 = 750 kHz)
+    success &= bq_set_register_bit(0x13, 0x20, low_frequency);
+
+    return success;
+}
+
 uint16_t bq_get_input_voltage_limit(void) {
     return bq_read_register(0x05) * 100;
 }
@@ -345,27 +438,41 @@ bool bq_disable_adc(void) {
 }
 
 uint16_t bq_measure_vbus(void) {
-    return bq_read_register16(0x35);
+    return telemetry_record_adc(TELEMETRY_ADC_VBUS, bq_read_register16(0x35));
 }
 
 uint16_t bq_measure_vac1(void) {
-    return bq_read_register16(0x37);
+    return telemetry_record_adc(TELEMETRY_ADC_VAC1, bq_read_register16(0x37));
 }
 
 uint16_t bq_measure_vac2(void) {
-    return bq_read_register16(0x39);
+    return telemetry_record_adc(TELEMETRY_ADC_VAC2, bq_read_register16(0x39));
 }
 
 int16_t bq_measure_ibus(void) {
-    return (int16_t)bq_read_register16(0x31);
+    return (int16_t)telemetry_record_adc(TELEMETRY_ADC_IBUS, bq_read_register16(0x31));
 }
 
 uint16_t bq_measure_vbat(void) {
-    return bq_read_register16(0x3B);
+    return telemetry_record_adc(TELEMETRY_ADC_VBAT, bq_read_register16(0x3B));
 }
 
 int16_t bq_measure_ibat(void) {
-    return (int16_t)bq_read_register16(0x33);
+    return (int16_t)telemetry_record_adc(TELEMETRY_ADC_IBAT, bq_read_register16(0x33));
+}
+
+void bq_measure_power(bool otg, int32_t *pin, int32_t *pout) {
+    // Calculate input/output power without using floating point arithmetic
+    int32_t pbus = ((int32_t)bq_measure_vbus() * (int32_t)bq_measure_ibus()) / 1000;  // mW
+    int32_t pbat = ((int32_t)bq_measure_vbat() * (int32_t)bq_measure_ibat()) / 1000;  // mW
+    if (otg) {
+        // OTG mode, discharging battery. Bus/battery power will be negative and swapped
+        *pin = -pbat;
+        *pout = -pbus;
+    } else {
+        *pin = pbus;
+        *pout = pbat;
+    }
 }
 
 uint16_t bq_get_fault_status(void) {
@@ -384,11 +491,11 @@ TemperatureStatus bq_get_temperature_status(void) {
 int16_t bq_measure_temperature(void) {
     // Measure chip die temperature (TDIE)
     // Temperature is in steps of 0.5 degrees Celsius
-    return bq_read_register16(0x41);
+    return telemetry_record_adc(TELEMETRY_ADC_TDIE, bq_read_register16(0x41));
 }
 
 uint16_t bq_measure_thermistor(void) {
     // Measure thermistor, returns relative reading (0..1023 corresponding to 0..100%)
     uint16_t thermistor_reading = bq_read_register16(0x3F);
-    return thermistor_reading;
+    return telemetry_record_adc(TELEMETRY_ADC_TS, thermistor_reading);
 }
@@ -36,7 +36,26 @@ typedef enum {
     TEMP_COLD = 0x8
 } TemperatureStatus;
 
+// Bits returned by bq_get_fault_status() (FAULT_Status_0 << 8 | FAULT_Status_1)
+typedef enum {
+    FAULT_TSHUT = 0x0004,
+    FAULT_OTG_UVP = 0x0010,
+    FAULT_VSYS_OVP = 0x0040,
+    FAULT_VSYS_SHORT = 0x0080,
+    FAULT_VAC1_OVP = 0x0100,
+    FAULT_VAC2_OVP = 0x0200,
+    FAULT_CONV_OCP = 0x0400,
+    FAULT_IBAT_OCP = 0x0800,
+    FAULT_IBUS_OCP = 0x1000,
+    FAULT_VBAT_OVP = 0x2000,
+    FAULT_VBUS_OVP = 0x4000
+} FaultStatus;
+
 bool bq_init(uint16_t charging_voltage_limit, uint16_t charging_current_limit);
+// Take over a charger that is still configured from before a warm reset, without resetting it.
+// The charge current limit and converter mode are set back to the bq_init() defaults.
+// Returns false if the configuration does not match.
+bool bq_resume(uint16_t charging_voltage_limit, uint16_t charging_current_limit);
 bool bq_test_connection(void);
 void bq_notify_interrupt(void);
 bool bq_process_interrupts(void);
@@ -46,11 +65,14 @@ bool bq_enable_bc12_detection(void);
 bool bq_disable_bc12_detection(void);
 bool bq_enable_otg(uint16_t votg);
 bool bq_disable_otg(void);
+bool bq_set_otg_voltage(uint16_t votg);
 bool bq_set_acdrv(bool enable_acdrv1, bool enable_acdrv2);
 bool bq_set_otg_current_limit(uint16_t ma);
+bool bq_set_charge_current_limit(uint16_t ma);
 bool bq_set_input_current_limit(uint16_t ma);
 bool bq_set_vbus_discharge(bool discharge);
 bool bq_set_thermistor(bool enable);
+bool bq_set_converter_mode(bool enable_pfm, bool low_frequency);
 
 uint16_t bq_get_input_voltage_limit(void);
 uint16_t bq_get_input_current_limit(void);
@@ -72,6 +94,7 @@ uint16_t bq_measure_vac2(void);
 int16_t bq_measure_ibus(void);
 uint16_t bq_measure_vbat(void);
 int16_t bq_measure_ibat(void);
+void bq_measure_power(bool otg, int32_t *pin, int32_t *pout);
 uint16_t bq_get_fault_status(void);
 TemperatureStatus bq_get_temperature_status(void);
 int16_t bq_measure_temperature(void);
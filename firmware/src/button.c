@@ -86,12 +86,12 @@ bool button_handle_config_menu(void) {
                 case 2:
                     // Charge while rig is on: toggle
                     config_item_index %= 2;
-                    sysconfig_update_word(&sysconfig->chargeWhenRigIsOn, config_item_index);
+                    sysconfig_update_byte(&sysconfig->chargeWhenRigIsOn, config_item_index);
                     break;
                 case 3:
                     // Thermistor: toggle
                     config_item_index %= 2;
-                    sysconfig_update_word(&sysconfig->enableThermistor, config_item_index);
+                    sysconfig_update_byte(&sysconfig->enableThermistor, config_item_index);
                     break;
             }
             config_short_press_pending = false;
@@ -174,7 +174,8 @@ void button_handle_interrupt(void) {
             config_medium_press_pending = true;
         } else {
             // Long press
-            // Reset system
+            // Reset system (after writing back pending config changes)
+            sysconfig_flush();
             ccp_write_io((void*)&(RSTCTRL.SWRR), RSTCTRL_SWRE_bm);
         }
     }
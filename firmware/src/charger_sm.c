@@ -7,6 +7,9 @@
 #include "sysconfig.h"
 #include "debug.h"
 #include "rtc.h"
+#include "thermal.h"
+#include "efficiency.h"
+#include "telemetry.h"
 #include "fsc_pd/timer.h"
 #include <avr/io.h>
 
@@ -14,14 +17,32 @@ static ChargerState current_state;
 static ChargerState pre_fault_state;
 static uint16_t otg_voltage;
 static uint16_t otg_current;
+static uint16_t otg_compensation;
+static uint16_t otg_compensation_ticks;
+static uint8_t otg_path_resistance = OTG_PATH_RESISTANCE_INITIAL;
 static struct TimerObj state_timer;
 static bool discharging_low_battery = false;
+static uint16_t source_selected_ticks;
+static bool source_dwell_elapsed;
+static uint8_t fault_retry_count;
+static uint16_t fault_seconds;      // in CHARGER_FAULT: seconds until next retry, otherwise: seconds until retry count reset
+static uint16_t fault_ticks;        // tick count at last update of fault_seconds
 
 static void update_led_for_state(void);
 static void check_fault_conditions(void);
 static void set_state(ChargerState new_state);
 static bool check_rig_inhibit(void);
 static void update_charging_led(void);
+static void start_source_dwell(void);
+static uint16_t estimate_dc_power(void);
+static uint16_t estimate_usb_power(void);
+static bool should_switch_source(uint16_t active_power, uint16_t other_power);
+static uint16_t derate(uint16_t ma);
+static void update_thermal_derating(void);
+static void update_efficiency(void);
+static void update_otg_compensation(void);
+static void recover_from_fault(void);
+static bool survives_reset(ChargerState state);
 
 /* State-specific functions (grouped by state) */
 static void enter_disconnected(void);
@@ -56,7 +77,9 @@ bool charger_sm_init(void) {
     pre_fault_state = CHARGER_DISCONNECTED;
     otg_voltage = 0;
     otg_current = 0;
+    otg_compensation = 0;
     discharging_low_battery = false;
+    fault_retry_count = 0;
     TimerDisable(&state_timer);
     return true;
 }
@@ -111,14 +134,11 @@ void charger_sm_on_pps_voltage_update(uint16_t mv) {
         if (otg_current == 0) {
             // No current limit set yet - use configured default
             otg_current = sysconfig->otgCurrentLimit;
-            bq_set_otg_current_limit(otg_current + OTG_CURRENT_HEADROOM);
+            bq_set_otg_current_limit(derate(otg_current + OTG_CURRENT_HEADROOM));
         }
-        uint16_t otg_voltage_eff = otg_voltage;
-        if (sysconfig->otgVoltageHeadroom <= OTG_VOLTAGE_HEADROOM_LIMIT) {
-            // Limit headroom for safety
-            otg_voltage_eff += sysconfig->otgVoltageHeadroom;
-        }
-        bq_enable_otg(otg_voltage_eff);
+        // Keep the current drop compensation (if any), as the load is not going to change
+        // just because the voltage was changed. It will be updated periodically while discharging.
+        bq_enable_otg(otg_voltage + otg_compensation);
         set_state(CHARGER_DISCHARGING);
     } else {
         // OTG mode ended
@@ -147,7 +167,7 @@ void charger_sm_on_pps_current_update(uint16_t ma) {
     // Otherwise, the IOTG limit will cause VOTG to drop (CC mode), which could lead to a PD reset.
     // Despite the name of this function and the related code in fsc_pd, we don't advertise PPS mode,
     // and thus don't need to guarantee accurate current limits.
-    bq_set_otg_current_limit(otg_current + OTG_CURRENT_HEADROOM);
+    bq_set_otg_current_limit(derate(otg_current + OTG_CURRENT_HEADROOM));
 }
 
 /* ===== State Machine Core ===== */
@@ -206,8 +226,17 @@ uint16_t charger_sm_run(void) {
             break;
     }
 
+    update_thermal_derating();
+    update_efficiency();
     update_led_for_state();
 
+    // There is no periodic wakeup while idle. Make sure we run at least once per second while
+    // charging/discharging or in a fault, as thermal derating, input source arbitration,
+    // the efficiency governor and fault recovery rely on being polled.
+    if (timeout == 0 && current_state != CHARGER_DISCONNECTED && current_state != CHARGER_RIG_ON) {
+        timeout = 1024;
+    }
+
     return timeout;
 }
 
@@ -221,6 +250,13 @@ static void enter_disconnected(void) {
     bq_disable_adc();
     otg_voltage = 0;
     otg_current = 0;
+    otg_compensation = 0;
+    fault_retry_count = 0;
+    efficiency_reset();
+    if (thermal_get_derating() < 100) {
+        thermal_reset();
+        bq_set_charge_current_limit(sysconfig->chargingCurrentLimit);
+    }
     led_shutdown();
 }
 
@@ -246,6 +282,7 @@ static uint16_t handle_disconnected(void) {
 
 static void enter_dc_charging(void) {
     discharging_low_battery = false;  // Clear low battery flag when entering charging
+    start_source_dwell();
     bq_set_acdrv(false, true);
     bq_set_input_current_limit(sysconfig->dcInputCurrentLimit);
     bq_enable_adc();
@@ -272,6 +309,12 @@ static uint16_t handle_dc_charging(void) {
         } else {
             set_state(CHARGER_DISCONNECTED);
         }
+    } else if (bq_get_ac1_present() && fsc_pd_get_connection_state() == AttachedSink) {
+        // Both inputs available - switch to USB if it can deliver substantially more power
+        if (should_switch_source(estimate_dc_power(), estimate_usb_power())) {
+            debug_printf("SM: Switching input to USB\n");
+            set_state(CHARGER_USB_NEGOTIATING);
+        }
     }
     return 0;
 }
@@ -282,6 +325,7 @@ static uint16_t handle_dc_charging(void) {
 
 static void enter_usb_negotiating(void) {
     // USB attached, waiting for PD negotiation
+    start_source_dwell();
     bq_set_acdrv(true, false);
     // Set default current while waiting for negotiation
     bq_set_input_current_limit(fsc_pd_get_advertised_current());
@@ -350,6 +394,9 @@ static uint16_t handle_usb_type_c_charging(void) {
         set_state(CHARGER_DISCONNECTED);
     } else if (fsc_pd_policy_has_contract()) {
         set_state(CHARGER_USB_PD_CHARGING);
+    } else if (bq_get_ac2_present() && should_switch_source(estimate_usb_power(), estimate_dc_power())) {
+        debug_printf("SM: Switching input to DC jack\n");
+        set_state(CHARGER_DC_CHARGING);
     }
     return 0;
 }
@@ -383,10 +430,108 @@ static uint16_t handle_usb_pd_charging(void) {
         set_state(CHARGER_DISCONNECTED);
     } else if (!fsc_pd_policy_has_contract()) {
         set_state(CHARGER_USB_TYPE_C_CHARGING);
+    } else if (bq_get_ac2_present() && should_switch_source(estimate_usb_power(), estimate_dc_power())) {
+        debug_printf("SM: Switching input to DC jack\n");
+        set_state(CHARGER_DC_CHARGING);
     }
     return 0;
 }
 
+/* ================================================================================
+ * Input source arbitration - used when both DC jack and USB are available
+ * ================================================================================ */
+
+static void start_source_dwell(void) {
+    source_selected_ticks = rtc_get_ticks();
+    source_dwell_elapsed = false;
+}
+
+// Estimated power available from the DC jack (VAC2), in units of 10 mW
+static uint16_t estimate_dc_power(void) {
+    return (bq_measure_vac2() / 100) * (sysconfig->dcInputCurrentLimit / 100);
+}
+
+// Estimated power available from USB (VAC1), in units of 10 mW. The current is taken from the
+// PD contract or the Type-C advertisement, the voltage is measured (reflects the PD contract voltage).
+static uint16_t estimate_usb_power(void) {
+    return (bq_measure_vac1() / 100) * (fsc_pd_get_advertised_current() / 100);
+}
+
+static bool should_switch_source(uint16_t active_power, uint16_t other_power) {
+    // Stay on the active input for a minimum time to let measurements settle and avoid flapping.
+    // The elapsed flag is latched, as the 16-bit tick counter wraps around after 64 seconds.
+    if (!source_dwell_elapsed) {
+        if ((uint16_t)(rtc_get_ticks() - source_selected_ticks) < SOURCE_SWITCH_DWELL_TIME) {
+            return false;
+        }
+        source_dwell_elapsed = true;
+    }
+
+    // Hysteresis: the other input must be substantially stronger
+    uint16_t margin = active_power / SOURCE_SWITCH_MARGIN_DIV;
+    if (margin < SOURCE_SWITCH_MARGIN_MIN) {
+        margin = SOURCE_SWITCH_MARGIN_MIN;
+    }
+    return other_power > active_power + margin;
+}
+
+/* ================================================================================
+ * Thermal derating - used while charging or discharging
+ * ================================================================================ */
+
+static uint16_t derate(uint16_t ma) {
+    uint8_t percent = thermal_get_derating();
+    if (percent >= 100) {
+        return ma;
+    }
+    return (uint32_t)ma * percent / 100;
+}
+
+static void update_thermal_derating(void) {
+    switch (current_state) {
+        case CHARGER_DC_CHARGING:
+        case CHARGER_USB_TYPE_C_CHARGING:
+        case CHARGER_USB_PD_CHARGING:
+        case CHARGER_DISCHARGING:
+            break;
+        default:
+            return;
+    }
+
+    if (!thermal_update()) {
+        return;
+    }
+
+    bq_set_charge_current_limit(derate(sysconfig->chargingCurrentLimit));
+    if (otg_current > 0) {
+        // Note that reducing IOTG below the current drawn by the sink will make VOTG drop,
+        // which may lead to a PD reset. Still better than OTG being suspended altogether.
+        uint16_t otg_limit = derate(otg_current + OTG_CURRENT_HEADROOM);
+        bq_set_otg_current_limit(otg_limit < 120 ? 120 : otg_limit);
+    }
+}
+
+static void update_efficiency(void) {
+    // Stick to fixed-frequency PWM at 1.5 MHz while the rig is on to avoid QRM. This applies in
+    // any state, as the converter keeps supplying VSYS even while charging is inhibited.
+    if (kx2_is_on()) {
+        efficiency_reset();
+        return;
+    }
+
+    switch (current_state) {
+        case CHARGER_DC_CHARGING:
+        case CHARGER_USB_TYPE_C_CHARGING:
+        case CHARGER_USB_PD_CHARGING:
+        case CHARGER_DISCHARGING:
+            break;
+        default:
+            return;
+    }
+
+    efficiency_update(current_state == CHARGER_DISCHARGING);
+}
+
 /* ================================================================================
  * CHARGER_RIG_ON - Rig powered on, charging inhibited
  * ================================================================================ */
@@ -413,6 +558,7 @@ static uint16_t handle_rig_on(void) {
 
 static void enter_discharging(void) {
     bq_enable_adc();
+    otg_compensation_ticks = rtc_get_ticks();
 }
 
 static uint16_t handle_discharging(void) {
@@ -434,10 +580,66 @@ static uint16_t handle_discharging(void) {
                         vbat, sysconfig->dischargingVoltageLimit);
             bq_disable_otg();
             set_state(CHARGER_DISCHARGING_BLOCKED);
+            return 0;
         }
     }
-    
-    return 0;
+
+    uint16_t now = rtc_get_ticks();
+    if ((uint16_t)(now - otg_compensation_ticks) >= OTG_COMPENSATION_INTERVAL) {
+        otg_compensation_ticks = now;
+        update_otg_compensation();
+    }
+
+    return OTG_COMPENSATION_INTERVAL;
+}
+
+/**
+ * @brief Compensate the voltage drop between the charger and the sink
+ *
+ * Raises VOTG by IBUS times the path resistance, so that the sink sees the negotiated voltage
+ * regardless of load. The path resistance consists of the part on the board (ACFETs, traces),
+ * which is learned from the difference between VBUS and VAC1, and the cable, which is derived
+ * from the configured OTG voltage headroom at the configured OTG current limit.
+ * The total compensation is limited to OTG_VOLTAGE_HEADROOM_LIMIT.
+ */
+static void update_otg_compensation(void) {
+    // IBUS is negative in OTG mode
+    int16_t ibus = -bq_measure_ibus();
+    if (ibus < 0) {
+        ibus = 0;
+    }
+
+    if (ibus >= OTG_LEARN_MIN_CURRENT) {
+        int16_t drop = (int16_t)(bq_measure_vbus() - bq_measure_vac1());
+        if (drop > 0) {
+            uint16_t sample = (uint32_t)drop * 1000 / ibus;
+            if (sample <= OTG_PATH_RESISTANCE_MAX) {
+                // Low-pass filter to average out ADC noise
+                otg_path_resistance += ((int16_t)sample - otg_path_resistance) / 8;
+            }
+        }
+    }
+
+    uint16_t resistance = otg_path_resistance;
+    if (sysconfig->otgVoltageHeadroom <= OTG_VOLTAGE_HEADROOM_LIMIT) {
+        resistance += (uint32_t)sysconfig->otgVoltageHeadroom * 1000 / sysconfig->otgCurrentLimit;
+    }
+
+    uint16_t compensation = (uint32_t)ibus * resistance / 1000;
+    if (compensation > OTG_VOLTAGE_HEADROOM_LIMIT) {
+        // Limit for safety
+        compensation = OTG_VOLTAGE_HEADROOM_LIMIT;
+    }
+
+    // VOTG has a resolution of 10 mV - skip small changes to avoid needless I2C traffic
+    int16_t delta = (int16_t)(compensation - otg_compensation);
+    if (delta > -20 && delta < 20) {
+        return;
+    }
+
+    debug_printf("SM: OTG drop compensation: %u mA x %u mOhm = %u mV\n", ibus, resistance, compensation);
+    otg_compensation = compensation;
+    bq_set_otg_voltage(otg_voltage + otg_compensation);
 }
 
 /* ================================================================================
@@ -461,13 +663,56 @@ static uint16_t handle_discharging_blocked(void) {
  * ================================================================================ */
 
 static uint16_t handle_fault(void) {
-    // Stay in fault state until input is disconnected
+    // Leave fault state when input is disconnected
     if (!bq_get_ac1_present() && !bq_get_ac2_present()) {
         set_state(CHARGER_DISCONNECTED);
+        return 0;
+    }
+
+    if (fault_retry_count >= FAULT_MAX_RETRIES) {
+        // Locked out - stay in fault state until input is disconnected
+        return 0;
+    }
+
+    // Wait for retry delay
+    uint8_t elapsed = rtc_take_elapsed_seconds(&fault_ticks);
+    if (fault_seconds > elapsed) {
+        fault_seconds -= elapsed;
+        return 1024;
+    }
+
+    fault_retry_count++;
+    uint16_t fault_status = bq_get_fault_status();
+    if (fault_status != 0) {
+        // Fault condition still present - back off further
+        debug_printf("SM: Fault still present: %x (retry %u)\n", fault_status, fault_retry_count);
+        fault_seconds = FAULT_RETRY_DELAY_MIN << fault_retry_count;
+        return 1024;
     }
+
+    debug_printf("SM: Fault cleared, retry %u, returning to state %d\n", fault_retry_count, pre_fault_state);
+    recover_from_fault();
     return 0;
 }
 
+static void recover_from_fault(void) {
+    // Re-initialize the affected blocks of the charger by re-entering the previous state,
+    // which reconfigures ACDRV, current limits and charging. OTG mode must be re-enabled
+    // explicitly, as the charger turns it off on faults like OTG_UVP or IBUS_OCP.
+    ChargerState state = pre_fault_state;
+    if (state == CHARGER_DISCHARGING) {
+        if (otg_voltage > 0) {
+            bq_enable_otg(otg_voltage + otg_compensation);
+        } else {
+            state = CHARGER_DISCONNECTED;
+        }
+    }
+
+    fault_seconds = FAULT_RETRY_RESET_TIME;
+    fault_ticks = rtc_get_ticks();
+    set_state(state);
+}
+
 /* ===== State transition handling ===== */
 
 static void set_state(ChargerState new_state) {
@@ -567,7 +812,8 @@ static void update_charging_led(void) {
         led_set_color(true, false, false, 255); // Red
     } else {
         // Color depends on temperature - green (or blue) for normal, yellow (or cyan) for warm/cool
-        bool warm_cool = (temp_status & (TEMP_WARM | TEMP_COOL)) ? true : false;
+        // Thermal derating is shown the same way, as the current is reduced as well.
+        bool warm_cool = ((temp_status & (TEMP_WARM | TEMP_COOL)) || thermal_get_derating() < 100) ? true : false;
         int16_t battery_current = bq_measure_ibat();
 
         if (current_state == CHARGER_DISCHARGING) {
@@ -612,18 +858,35 @@ static void update_charging_led(void) {
 }
 
 static void check_fault_conditions(void) {
+    if (current_state == CHARGER_FAULT) {
+        // Recovery is handled by handle_fault()
+        return;
+    }
+
     // Detect new faults
-    if (bq_get_fault_status() != 0) {
-        if (current_state != CHARGER_FAULT) {
-            pre_fault_state = current_state;
-            debug_printf("SM: Fault detected: %x\n", bq_get_fault_status());
-            set_state(CHARGER_FAULT);
+    uint16_t fault_status = bq_get_fault_status();
+    if (fault_status != 0) {
+        pre_fault_state = current_state;
+        debug_printf("SM: Fault detected: %x (retry %u)\n", fault_status, fault_retry_count);
+        telemetry_record_fault(fault_status, current_state);
+        if (fault_status & FAULT_PERSISTENT_MASK) {
+            // No point in retrying
+            fault_retry_count = FAULT_MAX_RETRIES;
         }
-    } else {
-        // No fault
-        if (current_state == CHARGER_FAULT) {
-            debug_printf("SM: Fault cleared, returning to state %d\n", pre_fault_state);
-            set_state(pre_fault_state);
+        if (fault_retry_count >= FAULT_MAX_RETRIES) {
+            debug_printf("SM: Fault lockout until input is disconnected\n");
+        } else {
+            fault_seconds = FAULT_RETRY_DELAY_MIN << fault_retry_count;
+            fault_ticks = rtc_get_ticks();
+        }
+        set_state(CHARGER_FAULT);
+    } else if (fault_retry_count > 0) {
+        // Forget about earlier faults after a while of fault-free operation
+        uint8_t elapsed = rtc_take_elapsed_seconds(&fault_ticks);
+        if (fault_seconds > elapsed) {
+            fault_seconds -= elapsed;
+        } else {
+            fault_retry_count = 0;
         }
     }
 }
@@ -633,3 +896,55 @@ static void check_fault_conditions(void) {
 ChargerState charger_sm_get_state(void) {
     return current_state;
 }
+
+/* ===== Warm reset ===== */
+
+// States in which the charger keeps working without the FUSB302 (see charger_sm_restore())
+static bool survives_reset(ChargerState state) {
+    return state == CHARGER_DC_CHARGING || state == CHARGER_RIG_ON || state == CHARGER_FAULT;
+}
+
+void charger_sm_save(ChargerSnapshot *snapshot) {
+    snapshot->state = current_state;
+    snapshot->pre_fault_state = pre_fault_state;
+    snapshot->otg_voltage = otg_voltage;
+    snapshot->otg_current = otg_current;
+    snapshot->otg_compensation = otg_compensation;
+    snapshot->otg_path_resistance = otg_path_resistance;
+    snapshot->discharging_low_battery = discharging_low_battery;
+    snapshot->fault_retry_count = fault_retry_count;
+    snapshot->fault_seconds = fault_seconds;
+}
+
+void charger_sm_restore(const ChargerSnapshot *snapshot) {
+    // The charger is still in the state it was before the reset, so resume in the same state
+    // without running its enter function. Only DC charging, rig on and faults survive the reset:
+    // USB charging and OTG depend on the PD contract, which ends when fsc_pd_init() resets the
+    // FUSB302, and negotiation relies on the state timer, which is lost. For these, start over
+    // from disconnected, which turns charging and OTG off.
+    current_state = snapshot->state;
+    pre_fault_state = snapshot->pre_fault_state;
+    if (current_state == CHARGER_FAULT && !survives_reset(pre_fault_state)) {
+        // Recovery would re-enable OTG or USB charging without a contract
+        pre_fault_state = CHARGER_DISCONNECTED;
+        bq_disable_charging();
+        bq_disable_otg();
+    }
+    if (!survives_reset(current_state)) {
+        current_state = CHARGER_DISCONNECTED;
+        enter_disconnected();
+    }
+    otg_path_resistance = snapshot->otg_path_resistance;
+    discharging_low_battery = snapshot->discharging_low_battery;
+    fault_retry_count = snapshot->fault_retry_count;
+    fault_seconds = snapshot->fault_seconds;
+    fault_ticks = rtc_get_ticks();
+    start_source_dwell();
+
+    // Re-apply thermal derating (restored before, see snapshot_restore()), as bq_resume() has
+    // set the charge current limit back to the default
+    if (thermal_get_derating() < 100) {
+        bq_set_charge_current_limit(derate(sysconfig->chargingCurrentLimit));
+    }
+    debug_printf("SM: Resumed in state %d\n", current_state);
+}
@@ -9,6 +9,22 @@
 #define OTG_VOLTAGE_HEADROOM_LIMIT 500  // mV - if headroom exceeds this, cap it to avoid overvoltage
 #define OTG_CURRENT_HEADROOM 250        // mA - add this much headroom to OTG current limit to avoid regulation and potential PD resets
 
+#define OTG_COMPENSATION_INTERVAL 1024  // ticks - how often to update the OTG voltage drop compensation
+#define OTG_PATH_RESISTANCE_INITIAL 30  // mOhm - initial estimate of ACFET/trace resistance between VBUS and VAC1, learned during operation
+#define OTG_PATH_RESISTANCE_MAX 200     // mOhm - samples above this are considered measurement errors
+#define OTG_LEARN_MIN_CURRENT 500       // mA - min. IBUS to take a path resistance sample (drop too small to measure otherwise)
+
+#define SOURCE_SWITCH_DWELL_TIME (30 * 1024UL)  // ticks - minimum time to stay on one input before switching to the other
+#define SOURCE_SWITCH_MARGIN_DIV 4              // other input must offer at least 1/4 more power than the active one...
+#define SOURCE_SWITCH_MARGIN_MIN 100            // ...and at least this much (in 10 mW units) before switching
+
+#define FAULT_RETRY_DELAY_MIN 2         // s - delay before first retry after a transient fault, doubled on each further retry
+#define FAULT_MAX_RETRIES 8             // lock out (until input is disconnected) after this many failed retries
+#define FAULT_RETRY_RESET_TIME 600      // s - forget about earlier faults after this long without a fault
+
+// Faults that indicate a problem with the battery or system side, which will not go away by retrying
+#define FAULT_PERSISTENT_MASK (FAULT_VBAT_OVP | FAULT_IBAT_OCP | FAULT_VSYS_OVP | FAULT_VSYS_SHORT)
+
 /**
  * @brief Charger state enumeration
  */
@@ -25,6 +41,21 @@ typedef enum {
     CHARGER_STATE_COUNT
 } ChargerState;
 
+/**
+ * @brief State machine variables that are preserved across warm resets (see snapshot.h)
+ */
+typedef struct {
+    ChargerState state;
+    ChargerState pre_fault_state;
+    uint16_t otg_voltage;
+    uint16_t otg_current;
+    uint16_t otg_compensation;
+    uint8_t otg_path_resistance;
+    bool discharging_low_battery;
+    uint8_t fault_retry_count;
+    uint16_t fault_seconds;
+} ChargerSnapshot;
+
 /**
  * @brief Initialize the charger state machine
  *
@@ -95,3 +126,22 @@ void charger_sm_on_pps_current_update(uint16_t ma);
  * @return Current ChargerState
  */
 ChargerState charger_sm_get_state(void);
+
+/* ===== Warm reset ===== */
+
+/**
+ * @brief Save the state machine variables that should survive a warm reset
+ *
+ * @param snapshot Destination
+ */
+void charger_sm_save(ChargerSnapshot *snapshot);
+
+/**
+ * @brief Resume from a snapshot taken before a warm reset
+ *
+ * Must be called after charger_sm_init() and thermal_restore(), and only if the charger
+ * has kept its configuration (see bq_resume()).
+ *
+ * @param snapshot Source
+ */
+void charger_sm_restore(const ChargerSnapshot *snapshot);
@@ -0,0 +1,81 @@
+/*
+ * Converter efficiency governor. bq_init() disables PFM and sets the switching frequency
+ * to 1.5 MHz, which is best at high load, but wastes power at light load (e.g. top-off
+ * charging or small OTG sinks). This selects the converter mode by output power:
+ *
+ * - light load:  PFM enabled, 750 kHz
+ * - medium load: PFM disabled, 750 kHz (lower switching losses)
+ * - high load:   PFM disabled, 1.5 MHz (lower inductor ripple current)
+ */
+#include "efficiency.h"
+#include "bq.h"
+#include "rtc.h"
+#include "debug.h"
+
+typedef enum {
+    LOAD_LIGHT = 0,
+    LOAD_MEDIUM = 1,
+    LOAD_HIGH = 2
+} LoadRegion;
+
+static const uint16_t region_limits[] = { EFFICIENCY_LIGHT_LOAD, EFFICIENCY_MEDIUM_LOAD };
+
+static LoadRegion current_region = LOAD_HIGH;
+static uint16_t last_update_ticks;
+
+static void set_region(LoadRegion region) {
+    if (region == current_region) {
+        return;
+    }
+    if (bq_set_converter_mode(region == LOAD_LIGHT, region != LOAD_HIGH)) {
+        debug_printf("EFF: Load region %d\n", region);
+        current_region = region;
+    }
+}
+
+void efficiency_reset(void) {
+    set_region(LOAD_HIGH);
+}
+
+uint8_t efficiency_get_region(void) {
+    return current_region;
+}
+
+void efficiency_restore(uint8_t region) {
+    set_region(region <= LOAD_HIGH ? (LoadRegion)region : LOAD_HIGH);
+    last_update_ticks = rtc_get_ticks();
+}
+
+void efficiency_update(bool otg) {
+    uint16_t now = rtc_get_ticks();
+    if ((uint16_t)(now - last_update_ticks) < EFFICIENCY_UPDATE_INTERVAL) {
+        return;
+    }
+    last_update_ticks = now;
+
+    int32_t pin, pout;
+    bq_measure_power(otg, &pin, &pout);
+    if (pout < 0) {
+        pout = 0;
+    }
+
+    // Move up/down one region at a time, with hysteresis around the limits
+    LoadRegion region = current_region;
+    if (region < LOAD_HIGH) {
+        uint16_t limit = region_limits[region];
+        if (pout > (int32_t)(limit + limit / EFFICIENCY_HYSTERESIS_DIV)) {
+            region++;
+        }
+    }
+    if (region == current_region && region > LOAD_LIGHT) {
+        uint16_t limit = region_limits[region - 1];
+        if (pout < (int32_t)(limit - limit / EFFICIENCY_HYSTERESIS_DIV)) {
+            region--;
+        }
+    }
+
+    if (region != current_region) {
+        debug_printf("EFF: Pin: %ld mW, Pout: %ld mW\n", pin, pout);
+        set_region(region);
+    }
+}
@@ -0,0 +1,25 @@
+/* Converter efficiency governor (PFM and switching frequency by load) */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define EFFICIENCY_UPDATE_INTERVAL  2048    // ticks
+#define EFFICIENCY_LIGHT_LOAD       1000    // mW - below this, enable PFM
+#define EFFICIENCY_MEDIUM_LOAD      5000    // mW - below this, switch at 750 kHz instead of 1.5 MHz
+#define EFFICIENCY_HYSTERESIS_DIV   4       // change region only when 1/4 beyond the limit
+
+// Restore the default converter mode (PFM disabled, 1.5 MHz) as configured by bq_init()
+void efficiency_reset(void);
+
+// Returns the current load region (for the snapshot, see snapshot.h)
+uint8_t efficiency_get_region(void);
+
+// Continue in the load region from before a warm reset. Must be called after bq_resume(),
+// which has set the default converter mode.
+void efficiency_restore(uint8_t region);
+
+// Select the converter mode for the current load. Should be called regularly while charging or
+// discharging (with the BQ ADC enabled), but not while the rig is on: PFM and the lower switching
+// frequency cause noise that is harder to filter, so use efficiency_reset() instead.
+void efficiency_update(bool otg);
@@ -4,18 +4,53 @@
 #include "charger_sm.h"
 #include "insomnia.h"
 #include "twi.h"
+#include "rtc.h"
 #include "debug.h"
 
 #define FUSB302_I2C_ADDR 0x22
+#define FUSB302_REG_CONTROL2 0x08
+#define FUSB302_REG_MASK 0x0A
+#define FUSB302_REG_MASKA 0x0E
+#define FUSB302_REG_MASKB 0x0F
+
+// FUSB302 interrupt mask bits
+#define FUSB302_M_BC_LVL        0x01    // MASK
+#define FUSB302_M_COLLISION     0x02
+#define FUSB302_M_CRC_CHK       0x10
+#define FUSB302_M_ACTIVITY      0x40
+#define FUSB302_M_HARDRST       0x01    // MASKA
+#define FUSB302_M_SOFTRST       0x02
+#define FUSB302_M_TXSENT        0x04
+#define FUSB302_M_HARDSENT      0x08
+#define FUSB302_M_RETRYFAIL     0x10
+#define FUSB302_M_SOFTFAIL      0x20
+#define FUSB302_M_GCRCSENT      0x01    // MASKB
+
+// Interrupts that only matter for PD communication
+#define FUSB302_MASK_PD         (FUSB302_M_COLLISION | FUSB302_M_CRC_CHK | FUSB302_M_ACTIVITY)
+#define FUSB302_MASKA_PD        (FUSB302_M_HARDRST | FUSB302_M_SOFTRST | FUSB302_M_TXSENT | \
+                                 FUSB302_M_HARDSENT | FUSB302_M_RETRYFAIL | FUSB302_M_SOFTFAIL)
+#define FUSB302_MASKB_PD        FUSB302_M_GCRCSENT
 
 static DevicePolicyPtr_t dpm;
 static Port_t port;
+static ConnectionState last_conn_state;
+static bool toggle_fast;
+static uint16_t toggle_fast_ticks;
+static volatile bool toggle_fast_requested;
+static uint8_t extra_mask[3];    // interrupt mask bits (MASK, MASKA, MASKB) set by us on top of the PD code's
 
 FSC_U8 PD_Specification_Revision;
 
 static void fsc_pd_event_handler(FSC_U32 event, FSC_U8 portId, void *usr_ctx, void *app_ctx);
+static uint16_t fsc_pd_update_toggle_power(void);
+static void fsc_pd_update_interrupt_mask(void);
 
 void fsc_pd_init(void) {
+    // TODO: After a warm reset, skip the FUSB302 reset in core_initialize() and re-enter the
+    // attached Type-C state from the snapshot, so that a PD contract is recovered with a soft
+    // reset instead of a detach/attach (requires a change to the PD stack, see fsc_pd.patch).
+    // Until then, any PD contract or OTG session ends on every reset.
     PD_Specification_Revision = sysconfig->pdMode == PD_3_0 ? USBPDSPECREV3p0 : USBPDSPECREV2p0;
     port.PortID = 0;
     core_initialize(&port, FUSB302_I2C_ADDR);
@@ -54,6 +89,10 @@ void fsc_pd_init(void) {
 
     register_observer(EVENT_ALL, fsc_pd_event_handler, NULL);
 
+    // Start with fast toggling, as something may be attached right after power up
+    last_conn_state = port.ConnState;
+    toggle_fast_requested = true;
+
     // FUSB_INT pin
     PORTA.PIN5CTRL = PORT_ISC_LEVEL_gc | PORT_PULLUPEN_bm;
 }
@@ -72,8 +111,87 @@ bool fsc_pd_test_connection(void) {
 // if no timed wakeup is required.
 uint16_t fsc_pd_run(void) {
     core_state_machine(&port);
+    fsc_pd_update_interrupt_mask();
     fsc_pd_enable_interrupt();
-    return core_get_next_timeout(&port);
+
+    uint16_t timeout = core_get_next_timeout(&port);
+    uint16_t toggle_timeout = fsc_pd_update_toggle_power();
+    if (toggle_timeout > 0 && (toggle_timeout < timeout || timeout == 0)) {
+        timeout = toggle_timeout;
+    }
+    return timeout;
+}
+
+static void fsc_pd_set_toggle_save_power(uint8_t level) {
+    if (port.Registers.Control.TOG_SAVE_PWR == level) {
+        return;
+    }
+    // Update the register copy of the PD code as well, as it writes back the whole register
+    port.Registers.Control.TOG_SAVE_PWR = level;
+    twi_send_bytes(FUSB302_I2C_ADDR, (uint8_t[]){FUSB302_REG_CONTROL2, port.Registers.Control.byte[2]}, 2);
+}
+
+// Returns the number of ticks until the next required wakeup, or 0 if none is required
+static uint16_t fsc_pd_update_toggle_power(void) {
+    if (sysconfig->role == SNK) {
+        // Nothing to speed up: as a sink, we only need to detect a source, and a few
+        // 100 ms of additional attach latency don't matter.
+        fsc_pd_set_toggle_save_power(FSC_PD_TOG_SAVE_PWR_IDLE);
+        return 0;
+    }
+
+    ConnectionState conn_state = port.ConnState;
+    if (toggle_fast_requested || (conn_state == Unattached && last_conn_state != Unattached)) {
+        // Detached (a reconnect is likely) or button pressed
+        toggle_fast_requested = false;
+        toggle_fast = true;
+        toggle_fast_ticks = rtc_get_ticks();
+        fsc_pd_set_toggle_save_power(FSC_PD_TOG_SAVE_PWR_FAST);
+    }
+    last_conn_state = conn_state;
+
+    if (toggle_fast) {
+        uint16_t elapsed = rtc_get_ticks() - toggle_fast_ticks;
+        if (elapsed < FSC_PD_TOGGLE_FAST_TIME) {
+            return FSC_PD_TOGGLE_FAST_TIME - elapsed;
+        }
+        toggle_fast = false;
+        fsc_pd_set_toggle_save_power(FSC_PD_TOG_SAVE_PWR_IDLE);
+    }
+    return 0;
+}
+
+static void fsc_pd_apply_mask(uint8_t reg, FSC_U8 *current, uint8_t *extra, uint8_t mask) {
+    // Only take ownership of bits that the PD code has not masked itself, so we
+    // never unmask something behind its back
+    uint8_t value = (*current & ~(*extra & ~mask)) | mask;
+    *extra = (*extra & mask) | (mask & ~*current);
+    if (value != *current) {
+        // Update the register copy of the PD code as well, as it writes back the whole register
+        *current = value;
+        twi_send_bytes(FUSB302_I2C_ADDR, (uint8_t[]){reg, value}, 2);
+    }
+}
+
+// Mask FUSB302 interrupts that are irrelevant in the current state. Every interrupt wakes us up
+// and runs the PD state machine, and some (e.g. BC_LVL) can fire frequently.
+static void fsc_pd_update_interrupt_mask(void) {
+    uint8_t mask = 0, maska = 0, maskb = 0;
+
+    if (port.ConnState == Unattached) {
+        // No PD communication possible
+        mask = FUSB302_MASK_PD;
+        maska = FUSB302_MASKA_PD;
+        maskb = FUSB302_MASKB_PD;
+    } else if (port.PolicyState == peSinkReady && port.PolicyHasContract) {
+        // With an explicit contract, the Type-C current advertisement (Rp level) no longer matters,
+        // and detach is detected via VBUS
+        mask = FUSB302_M_BC_LVL;
+    }
+
+    fsc_pd_apply_mask(FUSB302_REG_MASK, &port.Registers.Mask.byte, &extra_mask[0], mask);
+    fsc_pd_apply_mask(FUSB302_REG_MASKA, &port.Registers.MaskAdv.byte[0], &extra_mask[1], maska);
+    fsc_pd_apply_mask(FUSB302_REG_MASKB, &port.Registers.MaskAdv.byte[1], &extra_mask[2], maskb);
 }
 
 void fsc_pd_notify_interrupt(void) {
@@ -115,6 +233,9 @@ void fsc_pd_swap_roles(void) {
         port.PortConfig.reqPRSwapAsSnk = TRUE;
     } else if (port.PolicyState == peSourceReady) {
         port.PortConfig.reqPRSwapAsSrc = TRUE;
+    } else {
+        // Not connected - toggle fast for a while, as the user is probably about to plug something in
+        toggle_fast_requested = true;
     }
 }
 
@@ -4,6 +4,13 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+// DRP toggle power governor: FUSB302 TOG_SAVE_PWR setting (0 = no pause, 3 = 160 ms pause between
+// toggle cycles). Fast toggling is used for a while after a detach or button press, when an attach
+// is most likely, and the lowest power setting otherwise.
+#define FSC_PD_TOG_SAVE_PWR_FAST    0
+#define FSC_PD_TOG_SAVE_PWR_IDLE    3
+#define FSC_PD_TOGGLE_FAST_TIME     30720   // ticks (30 s)
+
 void fsc_pd_init(void);
 bool fsc_pd_test_connection(void);
 uint16_t fsc_pd_run(void);
@@ -16,4 +23,5 @@ PolicyState_t fsc_pd_get_policy_state(void);
 uint16_t fsc_pd_get_advertised_current(void);
 bool fsc_pd_policy_has_contract(void);
 
+// Swap roles if connected, otherwise speed up attach detection for a while
 void fsc_pd_swap_roles(void);
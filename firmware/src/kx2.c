@@ -1,4 +1,5 @@
 #include "kx2.h"
+#include "rtc.h"
 
 #include <avr/cpufunc.h>
 #include <avr/io.h>
@@ -15,6 +16,9 @@ bool kx2_is_on(void) {
 void kx2_handle_interrupt(void) {
     // This function can be expanded if any special handling is needed
     // when the KX2 power state changes.
+#ifndef RTC_SPI_PRELOAD
+    // Not needed if the RTC emulation preloads the first response byte,
+    // as it then has the time of an extra byte to wake up.
     if (kx2_is_on()) {
         // KX2 powered on - make OSC20M run in standby as we need to be ready
         // to respond to SPI requests within 10 us of RTC_CS being asserted, but
@@ -24,4 +28,8 @@ void kx2_handle_interrupt(void) {
         // KX2 powered off - can disable RUNSTDBY to save power
         ccp_write_io((void*)&(CLKCTRL.OSC20MCTRLA), 0);
     }
+#endif
+
+    // Keep the time in the RTC emulation up to date every second while the KX2 may read it
+    rtc_notify_kx2_power(kx2_is_on());
 }
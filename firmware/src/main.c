@@ -20,8 +20,12 @@
 #include "insomnia.h"
 #include "kx2.h"
 #include "watchdog.h"
+#include "bench.h"
+#include "snapshot.h"
+#include "telemetry.h"
 
-#ifdef DEBUG
+// Periodic charger status output (not in BENCH builds, where it would dominate the statistics)
+#if defined(DEBUG) && !defined(BENCH)
 #define DEBUG_STATUS
 #endif
 
@@ -36,12 +40,21 @@ ISR(BADISR_vect) {
 #endif
 
 int main(void) {
+    // Warm reset (watchdog or software reset): the charger has kept its configuration, and the
+    // state snapshot in RAM tells us what it was doing, so we can skip resetting it and get back
+    // to work quickly
+    uint8_t reset_flags = RSTCTRL.RSTFR;
+    RSTCTRL.RSTFR = 0xFF; // Clear reset flags
+    bool warm_reset = snapshot_load((reset_flags & (RSTCTRL_WDRF_bm | RSTCTRL_SWRF_bm)) &&
+        !(reset_flags & (RSTCTRL_PORF_bm | RSTCTRL_BORF_bm)));
+
     clock_init();
+    telemetry_init(reset_flags);
     watchdog_init();
     debug_init();
     twi_init();
-    led_wakeup();
-    led_init();
+    led_wakeup();   // includes led_init()
+    sysconfig_init();
     if (!sysconfig_valid()) {
         debug_printf("Invalid EEPROM configuration\n");
         led_set_blinking(true, false, false, 255, 5, 5, 4, 11);  // Red blinking, 4 x at 2 Hz with 1 second pause
@@ -54,30 +67,47 @@ int main(void) {
     // Enable global interrupts (also used for serial debug output)
     sei();
     
-    debug_printf("Startup, reset flags %x\n", RSTCTRL.RSTFR);
-    RSTCTRL.RSTFR = 0xFF; // Clear reset flags
-    
-    if (!bq_init(sysconfig->chargingVoltageLimit, sysconfig->chargingCurrentLimit)) {
+    debug_printf("Startup, reset flags %x\n", reset_flags);
+
+    if (warm_reset && !bq_resume(sysconfig->chargingVoltageLimit, sysconfig->chargingCurrentLimit)) {
+        // Charger configuration lost or changed - the snapshot no longer applies
+        warm_reset = false;
+    }
+    if (!warm_reset && !bq_init(sysconfig->chargingVoltageLimit, sysconfig->chargingCurrentLimit)) {
         debug_printf("BQ init failed\n");
         led_set_blinking(true, false, false, 255, 5, 5, 3, 11);  // Red blinking, 3 x at 2 Hz with 1 second pause
         while (1);
     }
     bq_set_thermistor(sysconfig->enableThermistor);
 
-    fsc_pd_init();
+    // Restore before fsc_pd_init(), which resets the FUSB302 and thereby ends any PD contract:
+    // charging or OTG that depended on it must be turned off before that happens
     charger_sm_init();
+    if (warm_reset) {
+        snapshot_restore();
+    }
+    fsc_pd_init();
     button_set_short_press_handler(fsc_pd_swap_roles);
 
-    // Power up blink
-    for (uint8_t i = 0; i < 3; i++) {
-        led_set_color(true, true, true, 255);
-        _delay_ms(200);
-        led_off();
-        _delay_ms(200);
+    // Power up blink (not after a warm reset, to resume service as quickly as possible)
+    if (!warm_reset) {
+        for (uint8_t i = 0; i < 3; i++) {
+            led_set_color(true, true, true, 255);
+            _delay_ms(200);
+            led_off();
+            _delay_ms(200);
+        }
+        led_shutdown();
     }
-    led_shutdown();
+
+#ifdef BENCH
+    bench_init();
+#endif
 
     while (1) {
+        // Write back config changes made by ISRs or the config menu
+        sysconfig_commit();
+
         if (button_handle_config_menu()) {
             // In config menu - skip normal processing
             watchdog_tickle();
@@ -96,32 +126,49 @@ int main(void) {
         // Run charger state machine - returns a timeout in ticks until the next required wakeup,
         // or 0 if no wakeup is needed and we can sleep until the next interrupt
         uint16_t sm_timeout = charger_sm_run();
+        snapshot_save();
+        telemetry_update();
         if (sm_timeout > 0 && (sm_timeout < next_timeout || next_timeout == 0)) {
             next_timeout = sm_timeout;
         }
 
+        // Run RTC background tasks (temperature compensation)
+        uint16_t rtc_timeout = rtc_run();
+        if (rtc_timeout > 0 && (rtc_timeout < next_timeout || next_timeout == 0)) {
+            next_timeout = rtc_timeout;
+        }
+
+        // Wake up in time to tickle the watchdog
+        if (next_timeout == 0 || next_timeout > WATCHDOG_TICKLE_INTERVAL) {
+            next_timeout = WATCHDOG_TICKLE_INTERVAL;
+        }
+
         // Enter low-power mode until next RTC alarm or other interrupt
         // Don't enter sleep if we need to wake up soon (otherwise we may miss the alarm)
-        if (next_timeout == 0 || next_timeout >= 100) {
-            if (next_timeout != 0) {
-                rtc_set_alarm(next_timeout);
-            }
+        if (next_timeout >= 100) {
+            rtc_set_alarm(next_timeout);
 
             // Only enter sleep mode if no insomnia mask bits are set;
             // use recommended procedure from avr/sleep.h to avoid race conditions
             set_sleep_mode(SLEEP_MODE_STANDBY);
             cli();
             if (insomnia_mask == 0) {
+#ifdef BENCH
+                bench_before_sleep();
+#endif
                 sleep_enable();
                 sei();
                 sleep_cpu();
                 sleep_disable();
+                telemetry_record_wake();
+#ifdef BENCH
+                bench_after_wake();
+#endif
             }
             sei();
         }
 
-        // Tickle the watchdog. Note that we get at least one interrupt per second due to the RTC PIT.
-        // If the latter is disabled, one must make sure to set the RTC alarm at less than the watchdog timeout interval.
+        // Tickle the watchdog. The RTC alarm above makes sure we get here at least every WATCHDOG_TICKLE_INTERVAL.
         watchdog_tickle();
 
 #ifdef DEBUG_STATUS
@@ -148,14 +195,8 @@ static void bq_print_status(void) {
     int16_t ibat = bq_measure_ibat();
 
     // Calculate input/output power and efficiency without using floating point arithmetic
-    int32_t pin = ((int32_t)vbus * (int32_t)ibus) / 1000;  // mW
-    int32_t pout = ((int32_t)vbat * (int32_t)ibat) / 1000; // mW
-    if (fsc_pd_get_connection_state() == AttachedSource) {
-        // OTG mode, discharging battery. pin/pout will be negative and swapped
-        int32_t temp = -pin;
-        pin = -pout;
-        pout = temp;
-    }
+    int32_t pin, pout;
+    bq_measure_power(fsc_pd_get_connection_state() == AttachedSource, &pin, &pout);
     uint32_t eff = 0;
     if (pin != 0 && pout != 0) {
         eff = pout * 1000 / pin; // 0..1000
@@ -4,6 +4,7 @@
  * used by the Elecraft KX2.
  *
  * Peripherals used: RTC, SPI0 (on alternate pins PC0-PC3), PORTC interrupt.
+ * With RTC_SPI_PROFILE: TCB0 and EVSYS channel 2 for measuring SPI response latency.
  */
 #include <avr/common.h>
 #include <avr/io.h>
@@ -18,22 +19,70 @@
 #include "debug.h"
 #include "insomnia.h"
 #include "userrow.h"
+#include "tempsense.h"
+#include "kx2.h"
+
+#ifdef RTC_SPI_PRELOAD
+// Preloading the first response byte relies on buffer mode
+#define RTC_SPI_BUFFERED
+#endif
 
 static volatile uint8_t nextRegister = 0;
 static volatile bool write = false;
+static volatile bool expectCommand = true;
+static volatile bool calibUpdatePending = false;
+
+// BCD image of the PCF2123 registers, so reads can be served with a simple table lookup
+// within the short time the KX2 gives us to respond. Only seconds (0x02), minutes (0x03)
+// and hours (0x04) are maintained, all other registers read as 0.
+// This is the only representation of the wall-clock time.
+static volatile uint8_t registers[16];
+
+#ifdef RTC_SPI_PROFILE
+static volatile uint16_t maxResponseCycles = 0;
+#ifndef BENCH
+#define RTC_SPI_PROFILE_REPORT_INTERVAL 60      // s
+static uint8_t profile_report_seconds = RTC_SPI_PROFILE_REPORT_INTERVAL;
+#endif
+#endif
 
-// We use the RTC peripheral to keep a running count of ticks (at 1024 Hz) in RTC.CNT,
-// and also use its periodic interrupt timer (PIT) to increment our wall-clock timekeeping.
-static volatile uint8_t hours = 0;
-static volatile uint8_t minutes = 0;
-static volatile uint8_t seconds = 0;
+// We use the RTC peripheral to keep a running count of ticks (at 1024 Hz) in RTC.CNT, extended
+// to 32 bits by counting overflows. The wall-clock time in the register image corresponds to
+// image_ticks, and is advanced by all full seconds elapsed since then whenever needed, instead
+// of waking up every second. Only while the KX2 is on (and may read the time at any moment),
+// the periodic interrupt timer (PIT) keeps the image up to date every second.
+static volatile uint16_t overflows = 0;
+static volatile uint32_t image_ticks = 0;
+
+// RTC.CALIB only has a resolution of 1 ppm. The total offset is kept in 1/16 ppm and
+// dithered into RTC.CALIB, i.e. the fractional part is applied as a +1 ppm step every
+// n-th RTC_CALIB_DITHER_INTERVAL.
+static int16_t calib_offset_x16 = 0;
+static uint8_t calib_dither = 0;
+static uint16_t calib_dither_seconds = 0;
+static uint16_t run_ticks;
 
-// Offset applied by temperature compensation 
-static volatile int16_t temperature_offset_ppm = 0;
+#ifdef RTC_TEMPERATURE_COMPENSATION
+// Offset applied by temperature compensation, in 1/16 ppm
+static int16_t temperature_offset_x16 = 0;
+static uint8_t tempcomp_count;                  // tempsense count of the last processed measurement
+static bool tempcomp_scheduled = false;         // a scheduled measurement is in progress
+static int16_t tempcomp_last_temperature;       // 1/16 °C, at the last scheduled measurement
+static uint16_t tempcomp_interval = RTC_TEMPCOMP_INTERVAL_MIN;
+static uint16_t tempcomp_seconds = 0;           // seconds until next scheduled measurement
+#endif
 
 static void spi_init(void);
-static void rtc_measure_temperature_offset(void);
+static void spi_flush(void);
+#ifdef RTC_TEMPERATURE_COMPENSATION
+static void rtc_process_temperature(void);
+#endif
 static void rtc_update_calib(void);
+static void rtc_apply_calib(void);
+static void rtc_catch_up(int16_t threshold);
+#ifdef RTC_SPI_PRELOAD
+static void rtc_preload_response(void);
+#endif
 
 void rtc_init(void) {
     spi_init();
@@ -45,13 +94,20 @@ void rtc_init(void) {
     RTC.CLKSEL = RTC_CLKSEL_TOSC32K_gc;
     while (RTC.STATUS & RTC_CTRLABUSY_bm); // Wait for sync
     RTC.CTRLA = RTC_RUNSTDBY_bm | RTC_PRESCALER_DIV32_gc | RTC_RTCEN_bm;
+    RTC.INTCTRL = RTC_OVF_bm;
 
-    rtc_measure_temperature_offset();
+    run_ticks = rtc_get_ticks();
+    rtc_update_calib();
+#ifdef RTC_TEMPERATURE_COMPENSATION
+    // Result will be processed by rtc_run()
+    tempsense_start();
+    tempcomp_scheduled = true;
+#endif
 
-    // Configure PIT for one second interrupts
+    // Configure PIT for one second interrupts (only enabled while the KX2 is on)
     while (RTC.PITSTATUS & RTC_CTRLBUSY_bm); // Wait for sync
     RTC.PITCTRLA = RTC_PERIOD_CYC32768_gc | RTC_PITEN_bm;
-    RTC.PITINTCTRL |= RTC_PI_bm;
+    rtc_notify_kx2_power(kx2_is_on());
 
 #ifdef RTC_CALIBRATION_MODE
     // Output 32.768 kHz /64 = 512 Hz clock on PA2 for measuring
@@ -62,9 +118,22 @@ void rtc_init(void) {
 }
 
 void rtc_get_time(uint8_t *phours, uint8_t *pminutes, uint8_t *pseconds) {
-    *phours = hours;
-    *pminutes = minutes;
-    *pseconds = seconds;
+    rtc_catch_up(1024);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        *phours = bcdToDecimal(registers[0x04]);
+        *pminutes = bcdToDecimal(registers[0x03]);
+        *pseconds = bcdToDecimal(registers[0x02]);
+    }
+}
+
+void rtc_notify_kx2_power(bool on) {
+    if (on) {
+        rtc_catch_up(1024);
+        RTC.PITINTFLAGS = RTC_PI_bm;
+        RTC.PITINTCTRL |= RTC_PI_bm;
+    } else {
+        RTC.PITINTCTRL &= ~RTC_PI_bm;
+    }
 }
 
 uint16_t rtc_get_ticks(void) {
@@ -77,6 +146,31 @@ uint16_t rtc_get_ticks(void) {
     return count;
 }
 
+#ifdef RTC_SPI_PROFILE
+uint16_t rtc_get_max_response_cycles(void) {
+    uint16_t cycles;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        cycles = maxResponseCycles;
+    }
+    return cycles;
+}
+#endif
+
+uint32_t rtc_get_ticks32(void) {
+    uint16_t high;
+    uint16_t count;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        while (RTC.STATUS & RTC_CNTBUSY_bm); // Wait for sync
+        count = RTC.CNT;
+        high = overflows;
+        if ((RTC.INTFLAGS & RTC_OVF_bm) && count < 0x8000) {
+            // Overflow occurred, but has not been counted by the ISR yet
+            high++;
+        }
+    }
+    return ((uint32_t)high << 16) | count;
+}
+
 void rtc_set_alarm(uint16_t ticks) {
     while (RTC.STATUS & RTC_CMPBUSY_bm); // Wait for sync
     RTC.CMP = rtc_get_ticks() + ticks;
@@ -93,24 +187,191 @@ static void spi_init(void) {
 
     // Switch to alternate SPI0 pins (PC0-PC3)
     PORTMUX.SPIROUTEA |= PORTMUX_SPI0_ALT1_gc;
-    SPI0.INTCTRL |= SPI_IE_bm; // Enable SPI interrupt
+
+#ifdef RTC_SPI_BUFFERED
+    // Use buffer mode, so the next byte of a multi-byte read can be preloaded while the
+    // current one is being shifted out. Only the first response byte after the command
+    // byte is then time critical.
+    SPI0.CTRLB = SPI_BUFEN_bm;
+    SPI0.INTCTRL = SPI_RXCIE_bm; // Enable receive complete interrupt
+#else
+    SPI0.INTCTRL = SPI_IE_bm; // Enable SPI interrupt
+#endif
     SPI0.CTRLA |= SPI_ENABLE_bm;
+
+    // Make SPI interrupt high priority, so other ISRs (e.g. PIT with temperature measurement)
+    // cannot delay the response
+    CPUINT.LVL1VEC = SPI0_INT_vect_num;
+
+#ifdef RTC_SPI_PRELOAD
+    rtc_preload_response();
+#endif
+
+#ifdef RTC_SPI_PROFILE
+    // Capture TCB0 count on each SCK (PC0) edge. In the SPI ISR, the difference between the
+    // current count and the captured count (= end of last byte) is the response latency.
+    EVSYS.CHANNEL2 = EVSYS_CHANNEL2_PORTC_PIN0_gc;
+    EVSYS.USERTCB0CAPT = EVSYS_USER_CHANNEL2_gc;
+    TCB0.CTRLB = TCB_CNTMODE_CAPT_gc;
+    TCB0.EVCTRL = TCB_CAPTEI_bm;
+    TCB0.CTRLA = TCB_RUNSTDBY_bm | TCB_CLKSEL_DIV1_gc | TCB_ENABLE_bm;
+#endif
+}
+
+// Discard any byte left in the transmit buffer (e.g. a register preloaded for a byte the KX2 did
+// not read, or a write dummy byte). In buffer mode, it would otherwise be sent as the first
+// response byte of the next read, shifting the response by one byte.
+// Must only be called while SS is inactive.
+static void spi_flush(void) {
+    SPI0.CTRLA &= ~SPI_ENABLE_bm;
+    SPI0.CTRLA |= SPI_ENABLE_bm;
+}
+
+// Advance the time in the register image by all full seconds elapsed since image_ticks.
+// The PIT interrupt uses a lower threshold, so it can never fall a second behind
+// due to the CNT synchronization delay, and never advances the time twice.
+static void rtc_catch_up(int16_t threshold) {
+    bool advanced;
+    do {
+        advanced = false;
+        // One second at a time, so the SPI interrupt is never blocked for long
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            if ((int32_t)(rtc_get_ticks32() - image_ticks) >= threshold) {
+                image_ticks += 1024;
+                uint8_t s = bcdIncrement(registers[0x02]);
+                if (s >= 0x60) {
+                    s = 0;
+                    uint8_t m = bcdIncrement(registers[0x03]);
+                    if (m >= 0x60) {
+                        m = 0;
+                        uint8_t h = bcdIncrement(registers[0x04]);
+                        registers[0x04] = (h >= 0x24) ? 0 : h;
+                    }
+                    registers[0x03] = m;
+                }
+                registers[0x02] = s;
+                advanced = true;
+#ifdef RTC_SPI_PRELOAD
+                if (PORTC.IN & PIN3_bm) {
+                    // SS inactive - refresh preloaded response
+                    rtc_preload_response();
+                }
+#endif
+            }
+        }
+    } while (advanced);
+}
+
+#ifdef RTC_SPI_PRELOAD
+// With OSC20M stopped in standby, the CPU cannot respond to the command byte in time. Instead,
+// the first response byte is preloaded before the transfer, assuming that the KX2 reads
+// starting from the seconds register. As BUFWR is 0, the byte stays in the transmit buffer
+// during the command byte and is sent as the first response byte. The CPU then has the time
+// of one byte to wake up and preload the following register.
+// Must only be called while SS is inactive.
+static void rtc_preload_response(void) {
+    spi_flush();
+    SPI0.DATA = registers[0x02];
+}
+#endif
+
+uint16_t rtc_run(void) {
+    rtc_catch_up(1024);
+
+    uint8_t elapsed = rtc_take_elapsed_seconds(&run_ticks);
+
+#ifdef RTC_TEMPERATURE_COMPENSATION
+    if (tempsense_get_count() != tempcomp_count) {
+        // New measurement available (possibly started by someone else)
+        tempcomp_count = tempsense_get_count();
+        rtc_process_temperature();
+    }
+    if (tempcomp_seconds > elapsed) {
+        tempcomp_seconds -= elapsed;
+    } else {
+        tempcomp_seconds = tempcomp_interval;
+        tempsense_start();
+        tempcomp_scheduled = true;
+    }
+#endif
+
+    if (calibUpdatePending) {
+        calibUpdatePending = false;
+        rtc_update_calib();
+    }
+
+#if defined(RTC_SPI_PROFILE) && !defined(BENCH)
+    // Report from the main loop, as debug output in an ISR would add to the latency being measured
+    // (the BENCH build includes it in its own report)
+    if (profile_report_seconds > elapsed) {
+        profile_report_seconds -= elapsed;
+    } else {
+        profile_report_seconds = RTC_SPI_PROFILE_REPORT_INTERVAL;
+        debug_printf("RTC SPI max response latency: %u cycles\n", rtc_get_max_response_cycles());
+    }
+#endif
+
+    if (calib_dither_seconds > elapsed) {
+        calib_dither_seconds -= elapsed;
+    } else {
+        calib_dither_seconds = RTC_CALIB_DITHER_INTERVAL;
+        rtc_apply_calib();
+    }
+
+    // Wake up for whatever comes next
+    uint16_t next_seconds = calib_dither_seconds;
+#ifdef RTC_TEMPERATURE_COMPENSATION
+    if (tempcomp_seconds < next_seconds) {
+        next_seconds = tempcomp_seconds;
+    }
+#endif
+    if (next_seconds > 60) {
+        next_seconds = 60;
+    }
+    return next_seconds * 1024;
+}
+
+uint8_t rtc_take_elapsed_seconds(uint16_t *ticks) {
+    uint8_t seconds = 0;
+    while ((uint16_t)(rtc_get_ticks() - *ticks) >= 1024) {
+        *ticks += 1024;
+        seconds++;
+    }
+    return seconds;
 }
 
-static void rtc_measure_temperature_offset(void) {
 #ifdef RTC_TEMPERATURE_COMPENSATION
-     // Measure temperature and adjust RTC.CALIB accordingly
+static void rtc_process_temperature(void) {
+    int16_t temperature = tempsense_get();
 
     // From Abracon ABS06 crystal datasheet:
     // - temperature coefficient: -0.03 ppm/T^2,
     // - turnover temperature: +25 °C
-    int16_t temp_diff = measure_chip_temperature() - 25;
-    int16_t offset_x100 = -3 * temp_diff * temp_diff;
-    temperature_offset_ppm = (offset_x100 + (offset_x100 >= 0 ? 50 : -50)) / 100;
-#endif
+    // With the temperature difference d in 1/16 °C, the offset in 1/16 ppm is -0.03 * d^2 / 16.
+    int32_t d = temperature - 25 * 16;
+    temperature_offset_x16 = -(int16_t)((3 * d * d + 800) / 1600);
+
+    if (tempcomp_scheduled) {
+        // Adapt measurement interval to how fast the temperature changes
+        tempcomp_scheduled = false;
+        int16_t change = temperature - tempcomp_last_temperature;
+        if (change < 0) {
+            change = -change;
+        }
+        if (change >= RTC_TEMPCOMP_FAST_CHANGE && tempcomp_interval > RTC_TEMPCOMP_INTERVAL_MIN) {
+            tempcomp_interval /= 2;
+        } else if (change < RTC_TEMPCOMP_SLOW_CHANGE && tempcomp_interval < RTC_TEMPCOMP_INTERVAL_MAX) {
+            tempcomp_interval *= 2;
+        }
+        tempcomp_last_temperature = temperature;
+        if (tempcomp_seconds > tempcomp_interval) {
+            tempcomp_seconds = tempcomp_interval;
+        }
+    }
 
     rtc_update_calib();
 }
+#endif
 
 static void rtc_update_calib(void) {
     int8_t factory_offset = 0;
@@ -119,20 +380,41 @@ static void rtc_update_calib(void) {
     }
 #ifdef RTC_CALIBRATION_MODE
     // Ignore temperature compensation and user offset in RTC calibration mode
-    int16_t total_offset = factory_offset;
+    int16_t total_offset_x16 = factory_offset * 16;
+#elif defined(RTC_TEMPERATURE_COMPENSATION)
+    int16_t total_offset_x16 = (sysconfig->userRtcOffset + factory_offset) * 16 + temperature_offset_x16;
 #else
-    int16_t total_offset = sysconfig->userRtcOffset + factory_offset + temperature_offset_ppm;
+    int16_t total_offset_x16 = (sysconfig->userRtcOffset + factory_offset) * 16;
 #endif
 
     // Clamp to RTC.CALIB range of -127 to 127
-    if (total_offset < -127) {
-        total_offset = -127;
-    } else if (total_offset > 127) {
-        total_offset = 127;
+    if (total_offset_x16 < -127 * 16) {
+        total_offset_x16 = -127 * 16;
+    } else if (total_offset_x16 > 127 * 16) {
+        total_offset_x16 = 127 * 16;
     }
 
-    debug_printf("RTC calibration update: user %d ppm, factory %d ppm, temp %d ppm => total %d ppm\n",
-                 sysconfig->userRtcOffset, factory_offset, temperature_offset_ppm, total_offset);
+    if (total_offset_x16 == calib_offset_x16) {
+        return;
+    }
+    calib_offset_x16 = total_offset_x16;
+
+    debug_printf("RTC calibration update: user %d ppm, factory %d ppm => total %d/16 ppm\n",
+                 sysconfig->userRtcOffset, factory_offset, total_offset_x16);
+
+    rtc_apply_calib();
+}
+
+static void rtc_apply_calib(void) {
+    // Apply integer part, plus 1 whenever the accumulated fractional part overflows
+    int16_t total_offset = calib_offset_x16 >> 4;  // rounds towards negative infinity
+    calib_dither += calib_offset_x16 & 0x0F;
+    if (calib_dither >= 16) {
+        calib_dither -= 16;
+        if (total_offset < 127) {
+            total_offset++;
+        }
+    }
 
     // CALIB does not use two's complement, but a sign bit + magnitude
     if (total_offset < 0) {
@@ -149,37 +431,37 @@ void rtc_handle_spi_ss(void) {
     if (PORTC.IN & PIN3_bm) {
         // SS went high
         insomnia_mask &= ~INSOMNIA_RTC_SPI;
+
+        // Reset state for next transfer here rather than when SS goes low, as this (lower priority)
+        // interrupt may only be serviced after the SPI interrupt for the command byte.
+#ifdef RTC_SPI_BUFFERED
+        SPI0.INTCTRL &= ~SPI_DREIE_bm;
+#endif
+        expectCommand = true;
+        write = false;
+#ifdef RTC_SPI_PRELOAD
+        rtc_preload_response();
+#else
+        spi_flush();
+#endif
     } else {
         // SS went low
         insomnia_mask |= INSOMNIA_RTC_SPI;
-
-        // Reset state
-        nextRegister = 0;
-        write = false;
-        SPI0.DATA = 0x00; // Dummy byte
     }
 }
 
 ISR(RTC_PIT_vect) {
     RTC.PITINTFLAGS |= RTC_PI_bm; // Clear interrupt flag
 
-    // This interrupt occurs every second
-    seconds++;
-    if (seconds >= 60) {
-        seconds = 0;
-        minutes++;
-        if (minutes >= 60) {
-            minutes = 0;
-            hours++;
-            if (hours >= 24) {
-                hours = 0;
-            }
-        }
-        rtc_measure_temperature_offset();
-    }
+    // This interrupt occurs every second while the KX2 is on
+    rtc_catch_up(512);
 }
 
 ISR(RTC_CNT_vect) {
+    if (RTC.INTFLAGS & RTC_OVF_bm) {
+        RTC.INTFLAGS = RTC_OVF_bm; // Clear interrupt flag
+        overflows++;
+    }
     if (RTC.INTFLAGS & RTC_CMP_bm) {
         RTC.INTFLAGS |= RTC_CMP_bm; // Clear interrupt flag
         // Alarm occurred
@@ -189,36 +471,63 @@ ISR(RTC_CNT_vect) {
 }
 
 ISR(SPI0_INT_vect) {
-    if (!(SPI0.INTFLAGS & SPI_IF_bm)) {
+    uint8_t flags = SPI0.INTFLAGS;
+
+#ifdef RTC_SPI_BUFFERED
+    if ((flags & SPI_DREIF_bm) && (SPI0.INTCTRL & SPI_DREIE_bm)) {
+        // Previous byte has been moved to the shift register - preload next register
+        SPI0.DATA = registers[nextRegister++ & 0x0F];
+    }
+
+    if (!(flags & SPI_RXCIF_bm)) {
+        return;
+    }
+#else
+    if (!(flags & SPI_IF_bm)) {
         return; // No interrupt flag
     }
+#endif
 
     uint8_t readData = SPI0.DATA;
 
-    if (nextRegister == 0) {
+    if (expectCommand) {
         // First byte is command byte
+        expectCommand = false;
+        nextRegister = readData & 0x0F;
         if (readData & 0x80) {
-            // Read command
+            // Read command: respond with first register right away. In buffer mode, the
+            // following registers are preloaded whenever the transmit buffer becomes empty.
             write = false;
+#ifdef RTC_SPI_PRELOAD
+            // First response byte (seconds) has already been preloaded. If the KX2 reads from
+            // another register, the first byte will be wrong, but the following ones will be correct.
+            nextRegister++;
+#else
+            SPI0.DATA = registers[nextRegister++];
+#endif
+#ifdef RTC_SPI_BUFFERED
+            SPI0.INTCTRL |= SPI_DREIE_bm;
+#endif
+#ifdef RTC_SPI_PROFILE
+            uint16_t cycles = TCB0.CNT - TCB0.CCMP;
+            if (cycles > maxResponseCycles) {
+                maxResponseCycles = cycles;
+            }
+#endif
         } else {
             // Write command
             write = true;
-        }
-        nextRegister = readData & 0x0F;
-        if (write) {
             SPI0.DATA = 0x00; // Dummy byte for write
-            return;
         }
+        return;
     }
 
     if (write) {
         // Write operation
-        if (nextRegister == 0x02) {
-            seconds = bcdToDecimal(readData);
-        } else if (nextRegister == 0x03) {
-            minutes = bcdToDecimal(readData);
-        } else if (nextRegister == 0x04) {
-            hours = bcdToDecimal(readData);
+        SPI0.DATA = 0x00;
+        if (nextRegister >= 0x02 && nextRegister <= 0x04) {
+            // Seconds, minutes, hours
+            registers[nextRegister] = readData;
         } else if (nextRegister == 0x0d) {
             int8_t offset = readData & 0x7F; // Assume KX2 always uses course mode
             if (offset & 0x40) {
@@ -233,23 +542,15 @@ ISR(SPI0_INT_vect) {
             // RTC ADJ menu and changes it.
             sysconfig_update_word(&sysconfig->userRtcOffset, newUserRtcOffset);
 
-            rtc_update_calib();
+            // Update RTC.CALIB from rtc_run(), to keep this high priority ISR short
+            calibUpdatePending = true;
         }
-        SPI0.DATA = 0x00;
+        nextRegister++;
     } else {
-        // Read operation
-        if (nextRegister == 0x02) {
-            // Read seconds
-            SPI0.DATA = decimalToBcd(seconds);
-        } else if (nextRegister == 0x03) {
-            // Read minutes
-            SPI0.DATA = decimalToBcd(minutes);
-        } else if (nextRegister == 0x04) {
-            // Read hours
-            SPI0.DATA = decimalToBcd(hours);
-        } else {
-            SPI0.DATA = 0x00;
-        }
+#ifndef RTC_SPI_BUFFERED
+        // Read operation: respond with the next register
+        SPI0.DATA = registers[nextRegister++ & 0x0F];
+#endif
+        // In buffer mode, the next register has already been preloaded
     }
-    nextRegister++;
-}
\ No newline at end of file
+}
@@ -1,6 +1,13 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
+
+#define RTC_TEMPCOMP_INTERVAL_MIN   16      // s - temperature measurement interval when temperature changes quickly...
+#define RTC_TEMPCOMP_INTERVAL_MAX   256     // s - ...and when it is stable
+#define RTC_TEMPCOMP_FAST_CHANGE    16      // 1/16 °C - halve interval if temperature changed at least this much...
+#define RTC_TEMPCOMP_SLOW_CHANGE    4       // 1/16 °C - ...double it if less than this
+#define RTC_CALIB_DITHER_INTERVAL   32      // s - RTC applies the correction over 10^6 crystal cycles (~30 s)
 
 void rtc_init(void);
 void rtc_get_time(uint8_t *hours, uint8_t *minutes, uint8_t *seconds);
@@ -11,8 +18,26 @@ void rtc_get_time_ms(uint8_t *phours, uint8_t *pminutes, uint8_t *pseconds, uint
 // 1000 or 1024 ms to a second is not important or can be compensated.
 uint16_t rtc_get_ticks(void);
 
+// Returns the current RTC ticks extended to 32 bits (wraps around after about 48 days)
+uint32_t rtc_get_ticks32(void);
+
 // Set an alarm to trigger an interrupt in a specified number of ticks.
 // This can be used to wake up the system from low-power mode.
 void rtc_set_alarm(uint16_t ticks);
 
 void rtc_handle_spi_ss(void);
+
+// Must be called when the KX2 is turned on or off. While the KX2 is on, the time is updated every second.
+void rtc_notify_kx2_power(bool on);
+
+#ifdef RTC_SPI_PROFILE
+// Returns the worst-case SPI response latency (in CPU cycles) seen so far
+uint16_t rtc_get_max_response_cycles(void);
+#endif
+
+// Run background tasks (temperature compensation). Returns a timeout in ticks until the next required wakeup.
+uint16_t rtc_run(void);
+
+// Returns the number of full seconds elapsed since *ticks, and advances *ticks accordingly.
+// Must be called at least every 64 seconds, as the tick counter wraps around.
+uint8_t rtc_take_elapsed_seconds(uint16_t *ticks);
@@ -0,0 +1,86 @@
+/*
+ * Snapshot of state that should survive a warm reset (watchdog or software reset), kept
+ * in a .noinit RAM section that is not cleared by the startup code. It is protected by
+ * a CRC, so random RAM contents after power-up or a half-written snapshot (reset during
+ * snapshot_save()) are never used.
+ *
+ * The PD stack is re-initialized on every reset (which resets the FUSB302), so its state
+ * is only recorded for diagnostics.
+ *
+ * The snapshot is compared against the current state on every main loop iteration, but only
+ * rewritten (with a new CRC) when something has changed.
+ */
+#include <stddef.h>
+#include <string.h>
+#include <util/crc16.h>
+
+#include "snapshot.h"
+#include "charger_sm.h"
+#include "fsc_pd_ctl.h"
+#include "thermal.h"
+#include "efficiency.h"
+#include "debug.h"
+
+typedef struct {
+    uint8_t version;
+    uint8_t warm_resets;                // number of warm resets since power-up (saturating)
+    ConnectionState pd_conn_state;
+    PolicyState_t pd_policy_state;
+    uint8_t thermal_derating;           // percent
+    uint8_t efficiency_region;
+    ChargerSnapshot charger;
+    uint16_t crc;
+} Snapshot;
+
+static Snapshot snapshot __attribute__((section(".noinit")));
+
+static uint16_t snapshot_crc(const Snapshot *s) {
+    uint16_t crc = 0xFFFF;
+    const uint8_t *p = (const uint8_t *)s;
+    for (uint8_t i = 0; i < offsetof(Snapshot, crc); i++) {
+        crc = _crc_ccitt_update(crc, p[i]);
+    }
+    return crc;
+}
+
+bool snapshot_load(bool warm_reset) {
+    if (warm_reset && snapshot.version == SNAPSHOT_VERSION && snapshot.crc == snapshot_crc(&snapshot)) {
+        return true;
+    }
+    memset(&snapshot, 0, sizeof(snapshot));
+    return false;
+}
+
+void snapshot_restore(void) {
+    if (snapshot.warm_resets < 255) {
+        snapshot.warm_resets++;
+        snapshot.crc = snapshot_crc(&snapshot);
+    }
+    debug_printf("Warm reset %u, PD state before: %d, %d\n", snapshot.warm_resets,
+        snapshot.pd_conn_state, snapshot.pd_policy_state);
+    // Derating and load region first: leaving a state that does not survive the reset
+    // resets them, and the charger state machine applies the derating to the current limit
+    thermal_restore(snapshot.thermal_derating);
+    efficiency_restore(snapshot.efficiency_region);
+    charger_sm_restore(&snapshot.charger);
+}
+
+void snapshot_save(void) {
+    Snapshot current = snapshot;
+    current.version = SNAPSHOT_VERSION;
+    current.pd_conn_state = fsc_pd_get_connection_state();
+    current.pd_policy_state = fsc_pd_get_policy_state();
+    current.thermal_derating = thermal_get_derating();
+    current.efficiency_region = efficiency_get_region();
+    charger_sm_save(&current.charger);
+    if (memcmp(&current, &snapshot, offsetof(Snapshot, crc)) == 0) {
+        return;
+    }
+
+    current.crc = snapshot_crc(&current);
+    snapshot = current;
+}
+
+uint8_t snapshot_get_warm_resets(void) {
+    return snapshot.warm_resets;
+}
@@ -0,0 +1,22 @@
+/* State preservation across warm resets */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SNAPSHOT_VERSION 2      // increment when the layout of the snapshot changes
+
+// Check for a valid snapshot from before the last reset, which can only exist after a
+// warm reset (RAM contents are random after power-up). Otherwise, the snapshot is cleared.
+// Returns true if the state can be restored.
+bool snapshot_load(bool warm_reset);
+
+// Restore the state from the snapshot. Must be called after the modules have been initialized.
+void snapshot_restore(void);
+
+// Update the snapshot with the current state. Should be called once per main loop iteration;
+// it is only rewritten if the state has changed.
+void snapshot_save(void);
+
+// Returns the number of warm resets since power-up (saturating at 255)
+uint8_t snapshot_get_warm_resets(void);
@@ -1,6 +1,11 @@
 #include <avr/eeprom.h>
+#include <avr/io.h>
+#include <avr/cpufunc.h>
+#include <util/atomic.h>
+#include <string.h>
 
 #include "sysconfig.h"
+#include "insomnia.h"
 #include "debug.h"
 
 // Definition for default EEPROM config, goes in .eeprom section, resulting in .eep file when compiling
@@ -19,13 +24,91 @@ volatile EEMEM struct SysConfig sysconfig_eeprom = {
     .userRtcOffset = 0
 };
 
-// Memory-mapped pointer to sysconfig in EEPROM
-struct SysConfig *sysconfig = (struct SysConfig*)MAPPED_EEPROM_START;
+// The config must fit into one EEPROM page, so all pending changes can be written in one operation
+_Static_assert(sizeof(struct SysConfig) <= EEPROM_PAGE_SIZE, "SysConfig must fit into one EEPROM page");
+_Static_assert(sizeof(struct SysConfig) <= 32, "SysConfig too large for dirty mask");
+
+// RAM copy of the config, and one bit per byte that has not been written to the EEPROM yet.
+// Writing to the EEPROM takes several ms, which we cannot afford in an ISR (e.g. SPI).
+// While changes are pending, the INSOMNIA_SYSCONFIG bit keeps the main loop from sleeping, so
+// they are committed as soon as the EEPROM is ready instead of after the next wakeup.
+static struct SysConfig sysconfig_ram;
+static volatile uint32_t sysconfig_dirty_mask;
+
+struct SysConfig *sysconfig = &sysconfig_ram;
+
+// Memory-mapped sysconfig in EEPROM
+static uint8_t * const sysconfig_mapped = (uint8_t*)MAPPED_EEPROM_START;
+
+void sysconfig_init(void) {
+    memcpy(&sysconfig_ram, sysconfig_mapped, sizeof(sysconfig_ram));
+    sysconfig_dirty_mask = 0;
+}
 
 bool sysconfig_valid(void) {
     return sysconfig->magic == SYSCONFIG_MAGIC;
 }
 
+static void sysconfig_update(void *addr, const uint8_t *data, uint8_t len) {
+    uint8_t offset = (uint8_t*)addr - (uint8_t*)&sysconfig_ram;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        for (uint8_t i = 0; i < len; i++) {
+            uint8_t *p = (uint8_t*)&sysconfig_ram + offset + i;
+            if (*p != data[i]) {
+                *p = data[i];
+                sysconfig_dirty_mask |= (uint32_t)1 << (offset + i);
+                insomnia_mask |= INSOMNIA_SYSCONFIG;
+            }
+        }
+    }
+}
+
+void sysconfig_update_byte(void *addr, uint8_t value) {
+    sysconfig_update(addr, &value, 1);
+}
+
 void sysconfig_update_word(void *addr, uint16_t value) {
-    eeprom_update_word(addr - MAPPED_EEPROM_START, value);
+    sysconfig_update(addr, (const uint8_t*)&value, 2);
+}
+
+void sysconfig_commit(void) {
+    if (sysconfig_dirty_mask == 0 || (NVMCTRL.STATUS & NVMCTRL_EEBUSY_bm)) {
+        return;
+    }
+
+    // Load pending bytes into the page buffer. Only bytes loaded into the page buffer
+    // are affected by the erase/write command, so there is no need to load the whole page.
+    bool loaded = false;
+    for (uint8_t i = 0; i < sizeof(struct SysConfig); i++) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            uint32_t bit = (uint32_t)1 << i;
+            if (sysconfig_dirty_mask & bit) {
+                sysconfig_dirty_mask &= ~bit;
+                uint8_t value = ((uint8_t*)&sysconfig_ram)[i];
+                if (sysconfig_mapped[i] != value) {
+                    sysconfig_mapped[i] = value;
+                    loaded = true;
+                }
+            }
+        }
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (sysconfig_dirty_mask == 0) {
+            insomnia_mask &= ~INSOMNIA_SYSCONFIG;
+        }
+    }
+
+    if (loaded) {
+        debug_printf("Writing config to EEPROM\n");
+        ccp_write_spm((void*)&NVMCTRL.CTRLA, NVMCTRL_CMD_PAGEERASEWRITE_gc);
+    }
+}
+
+void sysconfig_flush(void) {
+    do {
+        while (NVMCTRL.STATUS & NVMCTRL_EEBUSY_bm);
+        sysconfig_commit();
+    } while (sysconfig_dirty_mask != 0);
+    while (NVMCTRL.STATUS & NVMCTRL_EEBUSY_bm);
 }
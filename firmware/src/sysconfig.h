@@ -34,7 +34,20 @@ struct SysConfig {
     int16_t userRtcOffset;            // user RTC offset in ppm, set via KX2 RTC ADJ menu (-278 to +273)
 };
 
+// Points to a RAM copy of the config, which includes any updates not yet written to the EEPROM
 extern struct SysConfig *sysconfig;
 
+void sysconfig_init(void);
 bool sysconfig_valid(void);
+
+// Update a field of the config. Only updates the RAM copy (fast, can be called from an ISR);
+// the change is written to the EEPROM later by sysconfig_commit().
+void sysconfig_update_byte(void *addr, uint8_t value);
 void sysconfig_update_word(void *addr, uint16_t value);
+
+// Write pending changes to the EEPROM, if it is not busy. Call regularly from the main loop,
+// which must not sleep while changes are pending (see INSOMNIA_SYSCONFIG).
+void sysconfig_commit(void);
+
+// Write all pending changes to the EEPROM and wait for completion (e.g. before a reset)
+void sysconfig_flush(void);
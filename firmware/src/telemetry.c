@@ -0,0 +1,78 @@
+/*
+ * Telemetry block at a fixed SRAM address, which the programmer reads over UPDI while the
+ * CPU is running, giving insight into release builds without the debug UART (which changes
+ * timing). The firmware only stores values it has at hand anyway; it never does any I/O for
+ * telemetry.
+ *
+ * The block is in its own .telemetry section, placed by the linker (see Makefile). It is
+ * not part of .data or .bss, so it is neither initialized by the startup code nor included
+ * in the HEX file.
+ */
+#include <avr/io.h>
+#include <string.h>
+
+#include "telemetry.h"
+#include "fsc_pd_ctl.h"
+#include "thermal.h"
+#include "snapshot.h"
+#include "rtc.h"
+
+_Static_assert(sizeof(Telemetry) <= TELEMETRY_SIZE, "Telemetry block too large");
+_Static_assert(TELEMETRY_ADDRESS >= INTERNAL_SRAM_START && TELEMETRY_ADDRESS + TELEMETRY_SIZE - 1 <= INTERNAL_SRAM_END,
+               "Telemetry block outside of SRAM");
+
+static volatile Telemetry telemetry __attribute__((section(".telemetry"), used));
+
+static void begin_update(void) {
+    telemetry.seq_tail++;
+}
+
+static void end_update(void) {
+    telemetry.seq_head = telemetry.seq_tail;
+}
+
+void telemetry_init(uint8_t reset_flags) {
+    memset((void *)&telemetry, 0, sizeof(telemetry));
+    telemetry.size = sizeof(telemetry);
+    telemetry.version = TELEMETRY_VERSION;
+    telemetry.reset_flags = reset_flags;
+    // Valid from now on
+    telemetry.magic = TELEMETRY_MAGIC;
+}
+
+void telemetry_update(void) {
+    ChargerSnapshot charger;
+    charger_sm_save(&charger);
+
+    begin_update();
+    telemetry.warm_resets = snapshot_get_warm_resets();
+    telemetry.pd_conn_state = fsc_pd_get_connection_state();
+    telemetry.pd_policy_state = fsc_pd_get_policy_state();
+    telemetry.thermal_derating = thermal_get_derating();
+    telemetry.ticks = rtc_get_ticks32();
+    telemetry.charger = charger;
+    end_update();
+}
+
+uint16_t telemetry_record_adc(TelemetryAdc channel, uint16_t value) {
+    begin_update();
+    telemetry.adc[channel] = value;
+    end_update();
+    return value;
+}
+
+void telemetry_record_fault(uint16_t status, ChargerState state) {
+    begin_update();
+    volatile TelemetryFault *fault = &telemetry.faults[telemetry.fault_count % TELEMETRY_FAULT_HISTORY];
+    fault->status = status;
+    fault->state = state;
+    fault->ticks = rtc_get_ticks32();
+    telemetry.fault_count++;
+    end_update();
+}
+
+void telemetry_record_wake(void) {
+    begin_update();
+    telemetry.wakes++;
+    end_update();
+}
@@ -0,0 +1,66 @@
+/* Live telemetry, read by the programmer over UPDI while the firmware is running */
+#pragma once
+
+#include <stdint.h>
+#include "charger_sm.h"
+
+#define TELEMETRY_MAGIC 0x4B54      // "TK"
+#define TELEMETRY_VERSION 1         // increment when the layout of the telemetry block changes
+#define TELEMETRY_FAULT_HISTORY 4   // number of most recent faults kept
+
+// The block is placed at the top of SRAM, with the stack below it, by the Makefile, which also
+// defines TELEMETRY_ADDRESS and TELEMETRY_SIZE (the space reserved for it)
+
+typedef enum {
+    TELEMETRY_ADC_VBUS = 0,         // mV
+    TELEMETRY_ADC_VAC1,             // mV
+    TELEMETRY_ADC_VAC2,             // mV
+    TELEMETRY_ADC_IBUS,             // mA (signed)
+    TELEMETRY_ADC_VBAT,             // mV
+    TELEMETRY_ADC_IBAT,             // mA (signed)
+    TELEMETRY_ADC_TDIE,             // 0.5 °C (signed)
+    TELEMETRY_ADC_TS,               // 0..1023
+    TELEMETRY_ADC_COUNT
+} TelemetryAdc;
+
+typedef struct {
+    uint16_t status;                // bq_get_fault_status()
+    ChargerState state;             // state in which the fault occurred
+    uint32_t ticks;                 // rtc_get_ticks32() at the time of the fault
+} TelemetryFault;
+
+// The programmer reads the block in one go, in ascending address order, while the firmware
+// may be updating it. Every update first increments seq_tail and sets seq_head to the same
+// value when done, so a read is consistent if both counters match.
+typedef struct {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t size;                   // sizeof(Telemetry)
+    uint8_t seq_head;
+    uint8_t reset_flags;            // RSTCTRL.RSTFR after the last reset
+    uint8_t warm_resets;
+    uint8_t pd_conn_state;          // ConnectionState
+    uint8_t pd_policy_state;        // PolicyState_t
+    uint8_t thermal_derating;       // %
+    uint16_t wakes;                 // wakeups from sleep (wraps around)
+    uint32_t ticks;                 // rtc_get_ticks32() at the last update
+    uint16_t adc[TELEMETRY_ADC_COUNT];  // last value read from the charger ADC (not measured for telemetry)
+    ChargerSnapshot charger;
+    uint8_t fault_count;            // number of faults so far (wraps around); the most recent is
+                                    // faults[(fault_count - 1) % TELEMETRY_FAULT_HISTORY]
+    TelemetryFault faults[TELEMETRY_FAULT_HISTORY];
+    uint8_t seq_tail;
+} Telemetry;
+
+void telemetry_init(uint8_t reset_flags);
+
+// Update the state and counters. Should be called once per main loop iteration.
+void telemetry_update(void);
+
+// Record a value read from the charger ADC, returns the value
+uint16_t telemetry_record_adc(TelemetryAdc channel, uint16_t value);
+
+void telemetry_record_fault(uint16_t status, ChargerState state);
+
+// Call right after waking up from sleep
+void telemetry_record_wake(void);
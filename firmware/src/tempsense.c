@@ -0,0 +1,65 @@
+/*
+ * Background measurement of the MCU temperature using TEMPSENSE. ADC0 accumulates 16
+ * conversions, which improves resolution to well below 1 °C, and signals completion
+ * with the RESRDY interrupt, so the CPU can sleep instead of busy-waiting.
+ *
+ * Peripherals used: ADC0
+ */
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "tempsense.h"
+
+static volatile uint16_t tempsense_sum;     // accumulated result of last measurement
+static volatile uint8_t tempsense_count = 0;
+static volatile bool tempsense_busy = false;
+
+void tempsense_start(void) {
+    if (tempsense_busy) {
+        return;
+    }
+    tempsense_busy = true;
+
+    ADC0.CTRLA = ADC_ENABLE_bm | ADC_RUNSTDBY_bm;
+    ADC0.CTRLB = ADC_PRESC_DIV64_gc;
+    ADC0.CTRLC = ADC_REFSEL_1024MV_gc;
+    ADC0.CTRLE = 16;
+    ADC0.CTRLF = ADC_SAMPNUM_ACC16_gc;
+    ADC0.MUXPOS = ADC_MUXPOS_TEMPSENSE_gc;
+    ADC0.INTFLAGS = ADC_RESRDY_bm;
+    ADC0.INTCTRL = ADC_RESRDY_bm;
+    ADC0.COMMAND = ADC_MODE_SINGLE_12BIT_gc | ADC_START_IMMEDIATE_gc; // Start conversion
+}
+
+uint8_t tempsense_get_count(void) {
+    return tempsense_count;
+}
+
+int16_t tempsense_get(void) {
+    uint16_t sum;
+    // Disable interrupts to read 16-bit variable
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        sum = tempsense_sum;
+    }
+
+    // The factory calibration applies to 10-bit readings. The sum of 16 12-bit readings / 4
+    // is 16 times the average 10-bit reading, so the result is in 1/16 K.
+    int8_t sigrow_offset = SIGROW.TEMPSENSE1;
+    uint8_t sigrow_gain = SIGROW.TEMPSENSE0;
+
+    int32_t temp = (int32_t)(sum >> 2) - (int32_t)sigrow_offset * 16;
+    temp *= sigrow_gain;
+    temp += 0x80; // Add 1/2 to get correct rounding on division below
+    temp >>= 8;
+    return temp - 273 * 16;
+}
+
+ISR(ADC0_RESRDY_vect) {
+    tempsense_sum = ADC0.RESULT;
+    ADC0.INTFLAGS = ADC_RESRDY_bm;
+    ADC0.INTCTRL = 0;
+    ADC0.CTRLA = 0;
+    tempsense_count++;
+    tempsense_busy = false;
+}
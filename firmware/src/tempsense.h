@@ -0,0 +1,15 @@
+/* Oversampled, interrupt-driven measurement of the MCU temperature */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Start a measurement in the background (no-op if one is already running).
+// Completion wakes the CPU through the ADC interrupt.
+void tempsense_start(void);
+
+// Returns the number of completed measurements (wraps around), to detect new results
+uint8_t tempsense_get_count(void);
+
+// Returns the temperature of the last completed measurement, in 1/16 °C
+int16_t tempsense_get(void);
@@ -0,0 +1,80 @@
+/*
+ * Proportional thermal derating. Instead of letting the charger run at full power until
+ * it (or the battery) gets too hot and charging is suspended, the charge and OTG current
+ * are scaled down gradually to hold the hottest sensor at its target temperature.
+ *
+ * Sensors used: BQ die temperature, MCU temperature sensor and the NTC (if enabled).
+ */
+#include "thermal.h"
+#include "bq.h"
+#include "rtc.h"
+#include "tempsense.h"
+#include "sysconfig.h"
+#include "debug.h"
+
+static uint8_t derating_percent = 100;
+static uint16_t last_update_ticks;
+
+void thermal_reset(void) {
+    derating_percent = 100;
+    last_update_ticks = rtc_get_ticks();
+}
+
+void thermal_restore(uint8_t percent) {
+    derating_percent = (percent >= THERMAL_MIN_PERCENT && percent <= 100) ? percent : 100;
+    last_update_ticks = rtc_get_ticks();
+}
+
+static int16_t measure_mcu_excess(void) {
+    // Use the result of the last background measurement (at most one update interval old),
+    // and start a new one for the next update
+    int16_t temperature = tempsense_get() >> 4;
+    tempsense_start();
+    return temperature - THERMAL_TARGET_MCU;
+}
+
+bool thermal_update(void) {
+    uint16_t now = rtc_get_ticks();
+    if ((uint16_t)(now - last_update_ticks) < THERMAL_UPDATE_INTERVAL) {
+        return false;
+    }
+    last_update_ticks = now;
+
+    // Determine how far the hottest sensor is above its target (in °C)
+    int16_t excess = bq_measure_temperature() / 2 - THERMAL_TARGET_BQ_DIE;
+    int16_t mcu_excess = measure_mcu_excess();
+    if (mcu_excess > excess) {
+        excess = mcu_excess;
+    }
+    if (sysconfig->enableThermistor) {
+        // TS reading decreases with increasing temperature
+        int16_t ntc_excess = ((int16_t)THERMAL_TARGET_NTC - (int16_t)bq_measure_thermistor()) / THERMAL_NTC_PER_DEGREE;
+        if (ntc_excess > excess) {
+            excess = ntc_excess;
+        }
+    }
+
+    // Integrating controller: reduce quickly (proportional to excess), recover slowly
+    uint8_t percent = derating_percent;
+    if (excess > 0) {
+        if (excess > 10) {
+            excess = 10;
+        }
+        uint8_t step = excess * THERMAL_STEP_DOWN;
+        percent = (percent > THERMAL_MIN_PERCENT + step) ? percent - step : THERMAL_MIN_PERCENT;
+    } else if (excess <= -THERMAL_HYSTERESIS && percent < 100) {
+        percent += THERMAL_STEP_UP;
+    }
+
+    if (percent == derating_percent) {
+        return false;
+    }
+
+    debug_printf("Thermal: excess %d C, derating %u%% -> %u%%\n", excess, derating_percent, percent);
+    derating_percent = percent;
+    return true;
+}
+
+uint8_t thermal_get_derating(void) {
+    return derating_percent;
+}
@@ -0,0 +1,29 @@
+/* Thermal derating of charge and OTG current */
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define THERMAL_UPDATE_INTERVAL 4096    // ticks - temperatures change slowly, no need to update more often
+#define THERMAL_TARGET_BQ_DIE   90      // °C - charger die temperature to hold (BQ thermal regulation starts at 120 °C)
+#define THERMAL_TARGET_MCU      60      // °C - MCU temperature to hold (sits right next to the charger IC)
+#define THERMAL_TARGET_NTC      480     // TS reading (0..1023) of approx. 40 °C with the default NTC network
+#define THERMAL_NTC_PER_DEGREE  10      // TS reading change per °C around the target (approximation)
+#define THERMAL_HYSTERESIS      2       // °C - only ramp current back up when this far below all targets
+#define THERMAL_STEP_DOWN       2       // % per °C above target and update
+#define THERMAL_STEP_UP         1       // % per update
+#define THERMAL_MIN_PERCENT     20      // never derate below this
+
+// Reset derating to 100%
+void thermal_reset(void);
+
+// Continue with the derating percentage from before a warm reset (see snapshot.h). The charge
+// and OTG current limits are not changed.
+void thermal_restore(uint8_t percent);
+
+// Run the derating control loop. Should be called regularly while charging or discharging
+// (with the BQ ADC enabled). Returns true if the derating percentage has changed.
+bool thermal_update(void);
+
+// Returns the current derating percentage (THERMAL_MIN_PERCENT..100)
+uint8_t thermal_get_derating(void);
@@ -1,4 +1,9 @@
 #pragma once
 
+// The watchdog times out after 8 s. There is no periodic interrupt while idle, so the main loop
+// must wake up at least this often (in RTC ticks) to tickle the watchdog, leaving some margin for
+// the tolerance of the watchdog oscillator.
+#define WATCHDOG_TICKLE_INTERVAL 6144
+
 void watchdog_init(void);
 void watchdog_tickle(void);
@@ -0,0 +1,160 @@
+/**
+ * Flash image with checksum for CRCSCAN
+ * Builds the full flash image that is programmed (firmware padded with 0xFF, with a CRC-16 of
+ * the whole flash in its last two bytes), and verifies the flash contents on-chip with the
+ * CRCSCAN peripheral. Shared by the web programmer and the command line programmer.
+ */
+
+import { UpdiApplication } from './serialupdi/application.js';
+import { Timeout } from './serialupdi/timeout.js';
+import { ATTINY3226_DEVICE } from './devices.js';
+
+const CRCSCAN_ADDRESS = 0x0120;         // CRCSCAN peripheral address
+const CRCSCAN_CTRLA = 0x00;
+const CRCSCAN_CTRLB = 0x01;
+const CRCSCAN_STATUS = 0x02;
+const CRCSCAN_ENABLE_bm = 0x01;
+const CRCSCAN_RESET_bm = 0x80;
+const CRCSCAN_SRC_FLASH_gc = 0x00;
+const CRCSCAN_BUSY_bm = 0x01;
+const CRCSCAN_OK_bm = 0x02;
+const CRCSCAN_TIMEOUT = 500;            // milliseconds
+
+export interface FlashImage {
+    data: Uint8Array;       // Whole flash
+    length: number;         // Length of the firmware
+    hasChecksum: boolean;   // False if the firmware occupies the last two bytes
+}
+
+/**
+ * Compute CRC-16-CCITT (polynomial 0x1021, initial value 0xFFFF, not reflected) as used by CRCSCAN
+ * @returns CRC; 0 if the data ends with its own CRC (big endian)
+ */
+export function crc16Ccitt(data: Uint8Array): number {
+    let crc = 0xFFFF;
+    for (let i = 0; i < data.length; i++) {
+        crc ^= data[i] << 8;
+        for (let bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) & 0xFFFF : (crc << 1) & 0xFFFF;
+        }
+    }
+    return crc;
+}
+
+/**
+ * Build the full flash image: firmware padded with 0xFF, and the checksum for CRCSCAN in the
+ * last two bytes (unless the firmware occupies them)
+ * @param firmware firmware, starting at the beginning of the flash
+ * @throws Error if the firmware is larger than the flash
+ */
+export function buildFlashImage(firmware: Uint8Array): FlashImage {
+    const flashSize = ATTINY3226_DEVICE.flash_size!;
+    if (firmware.length > flashSize) {
+        throw new Error(`Firmware size (${firmware.length} bytes) exceeds flash size (${flashSize} bytes)`);
+    }
+
+    const data = new Uint8Array(flashSize).fill(0xFF);
+    data.set(firmware, 0);
+    const hasChecksum = firmware.length <= flashSize - 2;
+    if (hasChecksum) {
+        const crc = crc16Ccitt(data.subarray(0, flashSize - 2));
+        data[flashSize - 2] = crc >> 8;
+        data[flashSize - 1] = crc & 0xFF;
+    }
+    return { data, length: firmware.length, hasChecksum };
+}
+
+/**
+ * Indices of the pages to program: all pages covered by the firmware, plus the page holding the
+ * checksum
+ */
+export function flashImagePages(image: FlashImage): number[] {
+    const pageSize = ATTINY3226_DEVICE.flash_page_size!;
+    const totalPages = image.data.length / pageSize;
+    const imagePages = Math.ceil(image.length / pageSize);
+    const pages = Array.from({ length: imagePages }, (_, i) => i);
+    if (image.hasChecksum && imagePages < totalPages) {
+        pages.push(totalPages - 1);
+    }
+    return pages;
+}
+
+/**
+ * Let the CRCSCAN peripheral check the whole flash on-chip. The checksum is expected in the
+ * last two bytes of the flash (big endian).
+ * @param app connected UPDI application in programming mode
+ * @returns True if the flash contents match the checksum
+ */
+export async function runCrcScan(app: UpdiApplication): Promise<boolean> {
+    await app.writeData(CRCSCAN_ADDRESS + CRCSCAN_CTRLA, new Uint8Array([CRCSCAN_RESET_bm]));
+    await app.writeData(CRCSCAN_ADDRESS + CRCSCAN_CTRLB, new Uint8Array([CRCSCAN_SRC_FLASH_gc]));
+    await app.writeData(CRCSCAN_ADDRESS + CRCSCAN_CTRLA, new Uint8Array([CRCSCAN_ENABLE_bm]));
+
+    const timeout = new Timeout(CRCSCAN_TIMEOUT);
+    while (!timeout.expired()) {
+        const status = (await app.readData(CRCSCAN_ADDRESS + CRCSCAN_STATUS, 1))[0];
+        if (!(status & CRCSCAN_BUSY_bm)) {
+            return (status & CRCSCAN_OK_bm) !== 0;
+        }
+    }
+    throw new Error('Timeout waiting for CRCSCAN');
+}
+
+/**
+ * Check whether the flash already contains the given image, by comparing the stored checksum
+ * and letting CRCSCAN verify that the flash contents match it
+ * @param app connected UPDI application in programming mode
+ */
+export async function isFlashImageInstalled(app: UpdiApplication, image: FlashImage): Promise<boolean> {
+    if (!image.hasChecksum) {
+        return false;
+    }
+    const flashSize = image.data.length;
+    const stored = await app.readData(ATTINY3226_DEVICE.flash_address! + flashSize - 2, 2);
+    if (stored[0] !== image.data[flashSize - 2] || stored[1] !== image.data[flashSize - 1]) {
+        return false;
+    }
+    return await runCrcScan(app);
+}
+
+/**
+ * Read back the whole flash and compare it against the image. Pages that were not written in this
+ * programming run (e.g. left over from a larger firmware) are corrected, mismatches in written
+ * pages are reported as errors.
+ * @param app connected UPDI application in programming mode
+ * @param writtenAddresses addresses of the pages written in this programming run
+ * @param onProgress called after each page
+ * @returns number of pages that have been rewritten
+ */
+export async function verifyFlashByReadBack(app: UpdiApplication, image: FlashImage, writtenAddresses: Set<number>,
+                                            onProgress?: (done: number, total: number) => void): Promise<number> {
+    const flashAddress = ATTINY3226_DEVICE.flash_address!;
+    const pageSize = ATTINY3226_DEVICE.flash_page_size!;
+    const totalPages = image.data.length / pageSize;
+    let rewritten = 0;
+
+    for (let i = 0; i < totalPages; i++) {
+        const address = flashAddress + i * pageSize;
+        const data = image.data.subarray(i * pageSize, (i + 1) * pageSize);
+        const readBack = await app.readData(address, pageSize);
+        const mismatch = data.findIndex((byte, j) => readBack[j] !== byte);
+
+        if (mismatch >= 0) {
+            if (writtenAddresses.has(address)) {
+                const wrote = data[mismatch].toString(16).padStart(2, '0');
+                const read = readBack[mismatch].toString(16).padStart(2, '0');
+                throw new Error(`Verification failed at address 0x${(address + mismatch).toString(16)}: wrote 0x${wrote} but read 0x${read}`);
+            }
+
+            await app.eraseWriteFlashPage(address, data.slice());
+            const check = await app.readData(address, pageSize);
+            if (data.some((byte, j) => check[j] !== byte)) {
+                throw new Error(`Verification failed for page at 0x${address.toString(16)}`);
+            }
+            rewritten++;
+        }
+
+        onProgress?.(i + 1, totalPages);
+    }
+    return rewritten;
+}
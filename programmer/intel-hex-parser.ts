@@ -1,61 +1,253 @@
 /**
  * Intel HEX File Parser
- * Parses Intel HEX format files and merges segments into a single data array
+ * Single-pass parser that decodes records directly into an image of the target memory,
+ * validating record checksums. Supports extended segment and extended linear address
+ * records, and can parse incrementally from a ReadableStream.
  */
 
+export interface HexParseOptions {
+    imageSize?: number;     // Size of the target memory in bytes; data beyond it is an error
+    pageSize?: number;      // Page size for the dirty page bitmap in bytes (power of two)
+}
+
 export interface HexParseResult {
-    data: Uint8Array;
-    address: number;
+    data: Uint8Array;       // Image from address 0 up to the highest address with data (0xFF where there is none)
+    address: number;        // Lowest address with data
+    dirtyPages: Uint8Array; // Pages containing data: bit (n & 7) of byte (n >> 3) is set for page n
+    pageSize: number;
 }
 
+const DEFAULT_IMAGE_SIZE = 0x10000;
+const DEFAULT_PAGE_SIZE = 0x80;
+
+// Byte count, address (2), record type, up to 255 data bytes, checksum
+const MAX_RECORD_LENGTH = 255 + 5;
+
+// Record types
+const RECORD_DATA = 0x00;
+const RECORD_EOF = 0x01;
+const RECORD_EXTENDED_SEGMENT_ADDRESS = 0x02;
+const RECORD_START_SEGMENT_ADDRESS = 0x03;
+const RECORD_EXTENDED_LINEAR_ADDRESS = 0x04;
+const RECORD_START_LINEAR_ADDRESS = 0x05;
+
+const CHAR_COLON = 0x3A;
+const CHAR_LF = 0x0A;
+const CHAR_CR = 0x0D;
+const CHAR_SPACE = 0x20;
+const CHAR_TAB = 0x09;
+
+// Value of hex digits by character code, -1 for all other characters
+const HEX_NIBBLE = (() => {
+    const table = new Int8Array(256).fill(-1);
+    for (let i = 0; i < 10; i++) {
+        table[0x30 + i] = i;
+    }
+    for (let i = 0; i < 6; i++) {
+        table[0x41 + i] = 10 + i;
+        table[0x61 + i] = 10 + i;
+    }
+    return table;
+})();
+
 /**
- * Parse Intel HEX file and merge segments into a single Uint8Array
+ * Check whether a page contains data according to a dirty page bitmap
+ * @param dirtyPages bitmap from HexParseResult
+ * @param index page index
  */
-export async function parseHexFile(content: string): Promise<HexParseResult> {
-    const lines = content.split('\n').filter(line => line.trim().startsWith(':'));
-    const segments = new Map<number, number[]>();
-    
-    for (const line of lines) {
-        const byteCount = parseInt(line.substring(1, 3), 16);
-        const address = parseInt(line.substring(3, 7), 16);
-        const recordType = parseInt(line.substring(7, 9), 16);
-        
-        if (recordType === 0) {
-            // Data record
-            const hexData = line.substring(9, 9 + byteCount * 2);
-            if (!segments.has(address)) {
-                segments.set(address, []);
+export function isPageDirty(dirtyPages: Uint8Array, index: number): boolean {
+    return (dirtyPages[index >> 3] & (1 << (index & 7))) !== 0;
+}
+
+/**
+ * Incremental Intel HEX parser: feed the file in chunks of any size with push(), then call finish()
+ */
+export class IntelHexParser {
+    private image: Uint8Array;
+    private dirtyPages: Uint8Array;
+    private pageSize: number;
+    private record = new Uint8Array(MAX_RECORD_LENGTH);
+    private recordLength = 0;
+    private highNibble = -1;
+    private inRecord = false;
+    private line = 1;
+    private baseAddress = 0;
+    private minAddress = Infinity;
+    private endAddress = 0;
+    private done = false;
+
+    constructor(options: HexParseOptions = {}) {
+        const imageSize = options.imageSize ?? DEFAULT_IMAGE_SIZE;
+        this.pageSize = options.pageSize ?? DEFAULT_PAGE_SIZE;
+        this.image = new Uint8Array(imageSize).fill(0xFF);
+        this.dirtyPages = new Uint8Array(Math.ceil(imageSize / this.pageSize / 8));
+    }
+
+    /**
+     * Parse the next chunk of the file (chunks may end in the middle of a record)
+     * @param chunk text, or bytes of the file
+     */
+    push(chunk: Uint8Array | string): void {
+        if (typeof chunk === 'string') {
+            for (let i = 0; i < chunk.length && !this.done; i++) {
+                this.pushChar(chunk.charCodeAt(i));
             }
-            for (let i = 0; i < byteCount; i++) {
-                const byte = parseInt(hexData.substring(i * 2, i * 2 + 2), 16);
-                segments.get(address)!.push(byte);
+        } else {
+            for (let i = 0; i < chunk.length && !this.done; i++) {
+                this.pushChar(chunk[i]);
             }
-        } else if (recordType === 1) {
-            // End of file
-            break;
-        }
-    }
-    
-    // Find the address range
-    let minAddr = Infinity;
-    let maxAddr = 0;
-    
-    for (const addr of segments.keys()) {
-        minAddr = Math.min(minAddr, addr);
-        const endAddr = addr + segments.get(addr)!.length - 1;
-        maxAddr = Math.max(maxAddr, endAddr);
-    }
-    
-    // Merge all segments into a single Uint8Array
-    const mergedSize = maxAddr - minAddr + 1;
-    const mergedData = new Uint8Array(mergedSize);
-    
-    for (const [addr, bytes] of segments) {
-        const offset = addr - minAddr;
-        for (let i = 0; i < bytes.length; i++) {
-            mergedData[offset + i] = bytes[i];
-        }
-    }
-    
-    return { data: mergedData, address: minAddr };
+        }
+    }
+
+    /**
+     * Complete parsing
+     * @returns parse result
+     * @throws Error if the file is truncated
+     */
+    finish(): HexParseResult {
+        if (this.inRecord) {
+            this.endRecord();
+        }
+        if (!this.done) {
+            throw new Error('Missing end of file record');
+        }
+        return {
+            data: this.image.subarray(0, this.endAddress),
+            address: this.minAddress === Infinity ? 0 : this.minAddress,
+            dirtyPages: this.dirtyPages,
+            pageSize: this.pageSize,
+        };
+    }
+
+    private pushChar(c: number): void {
+        const nibble = HEX_NIBBLE[c];
+        if (nibble >= 0 && this.inRecord) {
+            if (this.highNibble < 0) {
+                this.highNibble = nibble;
+            } else {
+                if (this.recordLength >= MAX_RECORD_LENGTH) {
+                    throw new Error(`Record too long in line ${this.line}`);
+                }
+                this.record[this.recordLength++] = (this.highNibble << 4) | nibble;
+                this.highNibble = -1;
+            }
+        } else if (c === CHAR_COLON) {
+            if (this.inRecord) {
+                this.endRecord();
+            }
+            this.inRecord = true;
+            this.recordLength = 0;
+            this.highNibble = -1;
+        } else if (c === CHAR_LF || c === CHAR_CR) {
+            if (this.inRecord) {
+                this.endRecord();
+            }
+            if (c === CHAR_LF) {
+                this.line++;
+            }
+        } else if (c !== CHAR_SPACE && c !== CHAR_TAB) {
+            throw new Error(`Invalid character in line ${this.line}`);
+        }
+    }
+
+    private endRecord(): void {
+        this.inRecord = false;
+        const record = this.record;
+        const length = this.recordLength;
+
+        if (this.highNibble >= 0 || length < 5 || length !== record[0] + 5) {
+            throw new Error(`Invalid record length in line ${this.line}`);
+        }
+
+        let sum = 0;
+        for (let i = 0; i < length; i++) {
+            sum += record[i];
+        }
+        if ((sum & 0xFF) !== 0) {
+            throw new Error(`Checksum error in line ${this.line}`);
+        }
+
+        const dataLength = record[0];
+        const type = record[3];
+        if ((type === RECORD_EXTENDED_SEGMENT_ADDRESS || type === RECORD_EXTENDED_LINEAR_ADDRESS) && dataLength !== 2) {
+            throw new Error(`Invalid address record in line ${this.line}`);
+        }
+        const value = (record[4] << 8) | record[5];
+        switch (type) {
+            case RECORD_DATA:
+                this.storeData(this.baseAddress + ((record[1] << 8) | record[2]), dataLength);
+                break;
+            case RECORD_EOF:
+                this.done = true;
+                break;
+            case RECORD_EXTENDED_SEGMENT_ADDRESS:
+                this.baseAddress = value << 4;
+                break;
+            case RECORD_EXTENDED_LINEAR_ADDRESS:
+                this.baseAddress = value * 0x10000;
+                break;
+            case RECORD_START_SEGMENT_ADDRESS:
+            case RECORD_START_LINEAR_ADDRESS:
+                // Entry point - not relevant for programming
+                break;
+            default:
+                throw new Error(`Unknown record type ${type} in line ${this.line}`);
+        }
+    }
+
+    private storeData(address: number, length: number): void {
+        if (length === 0) {
+            return;
+        }
+        const end = address + length;
+        if (end > this.image.length) {
+            throw new Error(`Data at 0x${address.toString(16)} in line ${this.line} exceeds memory size (${this.image.length} bytes)`);
+        }
+
+        this.image.set(this.record.subarray(4, 4 + length), address);
+
+        const lastPage = (end - 1) / this.pageSize | 0;
+        for (let page = address / this.pageSize | 0; page <= lastPage; page++) {
+            this.dirtyPages[page >> 3] |= 1 << (page & 7);
+        }
+        if (address < this.minAddress) {
+            this.minAddress = address;
+        }
+        if (end > this.endAddress) {
+            this.endAddress = end;
+        }
+    }
+}
+
+/**
+ * Parse an Intel HEX file
+ * @param content file contents
+ * @param options image size and page size
+ */
+export async function parseHexFile(content: string, options?: HexParseOptions): Promise<HexParseResult> {
+    const parser = new IntelHexParser(options);
+    parser.push(content);
+    return parser.finish();
+}
+
+/**
+ * Parse an Intel HEX file incrementally while it is being read
+ * @param stream file contents (e.g. from File.stream())
+ * @param options image size and page size
+ */
+export async function parseHexStream(stream: ReadableStream<Uint8Array | string>, options?: HexParseOptions): Promise<HexParseResult> {
+    const parser = new IntelHexParser(options);
+    const reader = stream.getReader();
+    try {
+        while (true) {
+            const { value, done } = await reader.read();
+            if (done) {
+                break;
+            }
+            parser.push(value);
+        }
+    } finally {
+        reader.releaseLock();
+    }
+    return parser.finish();
 }
@@ -4,8 +4,14 @@
  */
 
 import { UpdiApplication } from './serialupdi/application.js';
-import { parseHexFile } from './intel-hex-parser.js';
+import { parseHexStream, isPageDirty } from './intel-hex-parser.js';
 import { ATTINY3226_DEVICE, type DeviceInfo } from './devices.js';
+import { type NvmRange } from './serialupdi/nvm.js';
+import { buildFlashImage, flashImagePages, isFlashImageInstalled, runCrcScan, verifyFlashByReadBack } from './flash-image.js';
+import {
+    TELEMETRY_ADDRESS, TELEMETRY_SIZE, type TelemetrySample, decodeTelemetry, stateName,
+    formatFaultStatus, formatResetFlags, CHARGER_STATE_NAMES, PD_CONN_STATE_NAMES, PD_POLICY_STATE_NAMES,
+} from './telemetry.js';
 
 // Device and memory addresses
 const DEVICE_ID_ADDRESS = 0x1100;       // Device ID register address
@@ -15,6 +21,9 @@ const EEPROM_CONFIG_SIZE = 20;          // Total size of config structure in byt
 const EEPROM_MAGIC = 0x4355;            // Magic value for configuration validation
 const MAX_FILE_SIZE = 1024 * 1024;      // 1MB file size limit
 const PROGRESS_COMPLETE_DELAY = 2000;   // milliseconds
+const TELEMETRY_INTERVAL = 250;         // milliseconds between telemetry reads
+const TELEMETRY_HISTORY_LENGTH = 240;   // samples kept for the plots (1 minute)
+const TELEMETRY_READ_RETRIES = 3;       // attempts to get a consistent read
 
 // Desired fuses configuration (9 bytes)
 const DESIRED_FUSES = new Uint8Array([0x00, 0x4A, 0x7E, 0xFF, 0xFF, 0xF6, 0xFF, 0x00, 0x00]);
@@ -80,6 +89,10 @@ const VALIDATION_CONSTRAINTS = {
 let app: UpdiApplication | null = null;
 let port: SerialPort | null = null;
 let currentProgramData: Uint8Array | null = null;
+let currentDirtyPages: Uint8Array | null = null;   // pages with data in the loaded HEX file (null: all)
+let telemetryPoll: Promise<void> | null = null;    // telemetry read in progress or scheduled (null: stopped)
+let telemetryTimer: ReturnType<typeof setTimeout> | null = null;
+let telemetryHistory: TelemetrySample[] = [];
 // Always use ATtiny3226 as the target device
 const selectedDevice: DeviceInfo = ATTINY3226_DEVICE;
 
@@ -129,6 +142,21 @@ function writeI16(bytes: Uint8Array, offset: number, value: number): void {
     writeU16(bytes, offset, unsigned);
 }
 
+/**
+ * Compare two byte arrays
+ */
+function bytesEqual(a: Uint8Array, b: Uint8Array): boolean {
+    if (a.length !== b.length) {
+        return false;
+    }
+    for (let i = 0; i < a.length; i++) {
+        if (a[i] !== b[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
 /**
  * Log a message to the operation log
  */
@@ -291,7 +319,7 @@ function handleError(error: unknown, defaultMessage: string): string {
  */
 function disableConnectionButtons(connected: boolean): void {
     // Buttons that should only be available when connected
-    const programmingButtons = ['btn-read-eeprom', 'btn-save-eeprom', 'btn-reset-eeprom', 'btn-program-fuses'];
+    const programmingButtons = ['btn-read-eeprom', 'btn-save-eeprom', 'btn-reset-eeprom', 'btn-program-fuses', 'btn-start-telemetry'];
     
     for (const id of programmingButtons) {
         const btn = getElement<HTMLButtonElement>(id);
@@ -312,6 +340,10 @@ function disableConnectionButtons(connected: boolean): void {
     // Disconnect button should be enabled when connected
     const disconnectBtn = getElement<HTMLButtonElement>('btn-disconnect');
     if (disconnectBtn) disconnectBtn.disabled = !connected;
+
+    // Telemetry can only be stopped while running
+    const stopTelemetryBtn = getElement<HTMLButtonElement>('btn-stop-telemetry');
+    if (stopTelemetryBtn) stopTelemetryBtn.disabled = true;
 }
 
 /**
@@ -339,6 +371,14 @@ export async function connectSerial(): Promise<void> {
         
         // Initialize the application
         await app.init();
+
+        // Speed up the link if possible
+        const negotiateCheckbox = getElement<HTMLInputElement>('baud-negotiate');
+        if (negotiateCheckbox?.checked) {
+            log('Negotiating baud rate...', 'info');
+            const negotiatedBaud = await app.negotiateBaud();
+            log(`Using ${negotiatedBaud} baud`, negotiatedBaud > baudRate ? 'success' : 'info');
+        }
         
         log('Connected successfully', 'success');
         updateStatus('connected');
@@ -404,9 +444,12 @@ export async function connectSerial(): Promise<void> {
         log(`Connection failed: ${handleError(error, 'Unknown error')}`, 'error');
         updateStatus('disconnected');
         
-        // Close the port on connection failure
+        // Close the port on connection failure (the UPDI stack holds the port's streams, so let it close it)
         try {
-            if (port) {
+            if (app) {
+                await app.destroy();
+                port = null;
+            } else if (port) {
                 await port.close();
                 port = null;
             }
@@ -424,6 +467,8 @@ export async function connectSerial(): Promise<void> {
  */
 export async function disconnectSerial(): Promise<void> {
     try {
+        await stopTelemetryPolling();
+
         // Leave programming mode if active
         if (app) {
             try {
@@ -436,7 +481,11 @@ export async function disconnectSerial(): Promise<void> {
         }
 
         if (port) {
-            await port.close();
+            if (app) {
+                await app.destroy();
+            } else {
+                await port.close();
+            }
             port = null;
             app = null;
             log('Disconnected', 'info');
@@ -444,6 +493,7 @@ export async function disconnectSerial(): Promise<void> {
             disableConnectionButtons(false);
             hideEepromConfiguration();
             hideFusesConfiguration();
+            hideTelemetry();
         }
     } catch (error) {
         log(`Disconnect failed: ${handleError(error, 'Unknown error')}`, 'error');
@@ -500,13 +550,17 @@ export async function handleFileSelect(event: Event): Promise<void> {
         
         if (ext === 'hex' || ext === 'eep') {
             // Parse as Intel HEX
-            const content = await file.text();
-            const result = await parseHexFile(content);
+            const result = await parseHexStream(file.stream(), {
+                imageSize: selectedDevice.flash_size,
+                pageSize: selectedDevice.flash_page_size,
+            });
             currentProgramData = result.data;
+            currentDirtyPages = result.dirtyPages;
             fileTypeLabel = 'Intel HEX File';
         } else {
             // Load as binary
             currentProgramData = await loadBinaryFile(file);
+            currentDirtyPages = null;
             fileTypeLabel = 'Binary File';
         }
         
@@ -528,13 +582,34 @@ export async function handleFileSelect(event: Event): Promise<void> {
     } catch (error) {
         log(`Error loading file: ${handleError(error, 'Unknown error')}`, 'error');
         currentProgramData = null;
+        currentDirtyPages = null;
         updateProgramFileButtonState();
     }
 }
 
+interface FlashPage {
+    address: number;
+    data: Uint8Array;
+}
+
+/**
+ * Get one page of a full flash image
+ */
+function getFlashPage(flashImage: Uint8Array, index: number): FlashPage {
+    const pageSize = selectedDevice.flash_page_size!;
+    return {
+        address: selectedDevice.flash_address! + index * pageSize,
+        data: flashImage.slice(index * pageSize, (index + 1) * pageSize),
+    };
+}
+
 /**
  * Program device flash memory from loaded file.
  * Validates file size, splits into pages, writes with verification.
+ * By default, only pages that differ from the current flash contents are written;
+ * the "erase and write all pages" option erases the whole flash first.
+ * A checksum of the whole flash is stored in its last two bytes, so that verification
+ * can be done on-chip with CRCSCAN, falling back to reading back the flash on a mismatch.
  * @throws Error if not connected, no file loaded, or file too large
  */
 export async function programFile(): Promise<void> {
@@ -551,115 +626,175 @@ export async function programFile(): Promise<void> {
         const memorySize = selectedDevice.flash_size!;
         const pageSize = selectedDevice.flash_page_size!;
         const startAddress = selectedDevice.flash_address!;
-        const flashSize = selectedDevice.flash_size!;
+        const totalFlashPages = memorySize / pageSize;
 
-        // Validate data fits in flash
-        if (currentProgramData.length > flashSize) {
-            throw new Error(`Firmware size (${currentProgramData.length} bytes) exceeds flash size (${flashSize} bytes)`);
-        }
+        // Full flash image with the checksum for CRCSCAN (also checks that the firmware fits)
+        const image = buildFlashImage(currentProgramData);
+        const flashImage = image.data;
+        const useCrcScan = image.hasChecksum;
 
         log(`Programming firmware to flash...`, 'info');
         log(`Flash: ${formatHex(startAddress)}, page size=${pageSize} bytes`, 'info');
+        const startTime = performance.now();
 
         // Get progress elements
         const progressDivEl = getElement<HTMLDivElement>('program-progress')!;
         const progressBarEl = getElement<HTMLDivElement>('program-progress-bar')!;
         const progressTextEl = getElement<HTMLElement>('program-progress-text')!;
-        
-        // Split data into pages
-        const pages: { address: number; data: Uint8Array }[] = [];
-        for (let offset = 0; offset < currentProgramData.length; offset += pageSize) {
-            const pageEnd = Math.min(offset + pageSize, currentProgramData.length);
-            let pageData = currentProgramData.slice(offset, pageEnd);
-            
-            // Pad the last page with 0xFF if it's smaller than page size
-            if (pageData.length < pageSize) {
-                const paddedData = new Uint8Array(pageSize);
-                paddedData.set(pageData, 0);
-                paddedData.fill(0xFF, pageData.length);
-                pageData = paddedData;
+
+        // Split data into pages: all pages covered by the firmware, plus the page holding the checksum
+        const pages = flashImagePages(image).map((index) => getFlashPage(flashImage, index));
+
+        const forceFull = getElement<HTMLInputElement>('program-force-full')?.checked ?? false;
+        progressDivEl.style.display = 'block';
+
+        // Quick check whether this firmware is already installed
+        const alreadyInstalled = !forceFull && useCrcScan && await isFlashImageInstalled(app, image);
+
+        // Pages that need to be written (and verified)
+        let changedPages: FlashPage[];
+
+        if (alreadyInstalled) {
+            log('This firmware is already installed (checksum verified with CRCSCAN)', 'success');
+            changedPages = [];
+        } else if (forceFull) {
+            // Erase all pages in the entire flash memory first
+            // (UPDI parts don't have a single flash erase command, so each page must be erased individually)
+            log(`Erasing ${totalFlashPages} flash pages...`, 'info');
+
+            progressBarEl.classList.add('program-progress-bar-erase');
+
+            for (let i = 0; i < totalFlashPages; i++) {
+                const pageAddress = startAddress + (i * pageSize);
+                await app.eraseFlashPage(pageAddress);
+
+                // Update progress bar for erasing
+                const eraseProgress = Math.round(((i + 1) / totalFlashPages) * 100);
+                progressBarEl.style.width = `${eraseProgress}%`;
+                progressTextEl.textContent = `Erasing: ${i + 1}/${totalFlashPages} pages (${eraseProgress}%)`;
             }
-            
-            const pageAddress = startAddress + offset;
-            pages.push({ address: pageAddress, data: pageData });
+
+            log(`Erased ${totalFlashPages} flash pages`, 'success');
+            progressBarEl.classList.remove('program-progress-bar-erase');
+
+            // Pages without any data in the HEX file are blank, so there is no need to write them
+            // (except for the page holding the checksum)
+            const dirtyPages = currentDirtyPages;
+            changedPages = pages.filter((page) => {
+                const index = (page.address - startAddress) / pageSize;
+                return !dirtyPages || isPageDirty(dirtyPages, index) || (useCrcScan && index === totalFlashPages - 1);
+            });
+        } else {
+            // Differential mode: compare against the current flash contents and only program the pages that
+            // differ. Pages beyond the end of the new image are left as they are (they are never executed).
+            log(`Comparing ${pages.length} pages with flash contents...`, 'info');
+            progressBarEl.classList.add('program-progress-bar-verify');
+            changedPages = [];
+
+            for (let i = 0; i < pages.length; i++) {
+                const page = pages[i];
+                const current = await app.readData(page.address, page.data.length);
+                if (!bytesEqual(current, page.data)) {
+                    changedPages.push(page);
+                }
+
+                const compareProgress = Math.round(((i + 1) / pages.length) * 100);
+                progressBarEl.style.width = `${compareProgress}%`;
+                progressTextEl.textContent = `Comparing: ${i + 1}/${pages.length} pages (${compareProgress}%)`;
+            }
+
+            log(`${changedPages.length} of ${pages.length} pages differ`, 'info');
+            progressBarEl.classList.remove('program-progress-bar-verify');
         }
 
-        // Erase all pages in the entire flash memory first
-        // (UPDI parts don't have a single flash erase command, so each page must be erased individually)
-        const totalFlashPages = memorySize / pageSize;
-        log(`Erasing ${totalFlashPages} flash pages...`, 'info');
-        
-        progressDivEl.style.display = 'block';
-        progressBarEl.classList.add('program-progress-bar-erase');
-        
-        for (let i = 0; i < totalFlashPages; i++) {
-            const pageAddress = startAddress + (i * pageSize);
-            await app.eraseFlashPage(pageAddress);
-            
-            // Update progress bar for erasing
-            const eraseProgress = Math.round(((i + 1) / totalFlashPages) * 100);
-            progressBarEl.style.width = `${eraseProgress}%`;
-            progressTextEl.textContent = `Erasing: ${i + 1}/${totalFlashPages} pages (${eraseProgress}%)`;
+        // Write pages to flash
+        if (changedPages.length > 0) {
+            log(`Writing ${changedPages.length} pages...`, 'info');
         }
-        
-        log(`Erased ${totalFlashPages} flash pages`, 'success');
-        progressBarEl.classList.remove('program-progress-bar-erase');
 
-        // Write all pages to flash
-        log(`Writing ${pages.length} pages...`, 'info');
-        progressDivEl.style.display = 'block';
-        
-        for (let i = 0; i < pages.length; i++) {
-            const page = pages[i];
-            await app.writeFlash(page.address, page.data);
+        for (let i = 0; i < changedPages.length; i++) {
+            const page = changedPages[i];
+            if (forceFull) {
+                await app.writeFlash(page.address, page.data);
+            } else {
+                await app.eraseWriteFlashPage(page.address, page.data);
+            }
+
+            log(`Wrote page at ${formatHex(page.address)}: ${page.data.length} bytes`, 'info');
 
-            log(`Wrote page ${i + 1} at ${formatHex(page.address)}: ${page.data.length} bytes`, 'info');
-            
             // Update progress bar
-            const writeProgress = Math.round(((i + 1) / pages.length) * 100);
+            const writeProgress = Math.round(((i + 1) / changedPages.length) * 100);
             progressBarEl.style.width = `${writeProgress}%`;
-            progressTextEl.textContent = `Writing: ${i + 1}/${pages.length} pages (${writeProgress}%)`;
+            progressTextEl.textContent = `Writing: ${i + 1}/${changedPages.length} pages (${writeProgress}%)`;
         }
 
-        // Verify all pages
-        log('Verifying programmed data...', 'info');
-        progressBarEl.classList.add('program-progress-bar-verify');
-        progressTextEl.textContent = 'Verifying...';
-        
-        for (let i = 0; i < pages.length; i++) {
-            const page = pages[i];
-            const readBack = await app.readData(page.address, page.data.length);
-            for (let j = 0; j < page.data.length; j++) {
-                if (readBack[j] !== page.data[j]) {
-                    const addr = formatHex(page.address + j);
-                    const wrote = formatByte(page.data[j]);
-                    const read = formatByte(readBack[j]);
-                    throw new Error(`Verification failed at address ${addr}: wrote ${wrote} but read ${read}`);
+        // Verify
+        if (changedPages.length > 0) {
+            log('Verifying programmed data...', 'info');
+            progressBarEl.classList.add('program-progress-bar-verify');
+            progressTextEl.textContent = 'Verifying...';
+
+            if (useCrcScan && await runCrcScan(app)) {
+                log('Verified flash contents on-chip with CRCSCAN', 'success');
+            } else if (useCrcScan) {
+                // Either a write failed, or there are stale pages beyond the end of the image
+                log('CRCSCAN reports a mismatch, reading back flash...', 'warn');
+                const writtenAddresses = new Set(changedPages.map(page => page.address));
+                const rewritten = await verifyFlashByReadBack(app, image, writtenAddresses, (done, total) => {
+                    const verifyProgress = Math.round((done / total) * 100);
+                    progressBarEl.style.width = `${verifyProgress}%`;
+                    progressTextEl.textContent = `Verifying: ${done}/${total} pages (${verifyProgress}%)`;
+                });
+                if (rewritten > 0) {
+                    log(`Rewrote ${rewritten} page(s) with stale contents`, 'info');
+                }
+                if (!await runCrcScan(app)) {
+                    throw new Error('CRCSCAN verification failed after read-back');
+                }
+            } else {
+                // No room for the checksum - read back the written pages (unchanged pages have just been compared)
+                for (let i = 0; i < changedPages.length; i++) {
+                    const page = changedPages[i];
+                    const readBack = await app.readData(page.address, page.data.length);
+                    for (let j = 0; j < page.data.length; j++) {
+                        if (readBack[j] !== page.data[j]) {
+                            const addr = formatHex(page.address + j);
+                            const wrote = formatByte(page.data[j]);
+                            const read = formatByte(readBack[j]);
+                            throw new Error(`Verification failed at address ${addr}: wrote ${wrote} but read ${read}`);
+                        }
+                    }
+                    log(`Verified page at ${formatHex(page.address)}`, 'info');
+
+                    // Update verify progress
+                    const verifyProgress = Math.round(((i + 1) / changedPages.length) * 100);
+                    progressBarEl.style.width = `${verifyProgress}%`;
+                    progressTextEl.textContent = `Verifying: ${i + 1}/${changedPages.length} pages (${verifyProgress}%)`;
                 }
             }
-            log(`Verified page ${i + 1} at ${formatHex(page.address)}`, 'info');
-            
-            // Update verify progress
-            const verifyProgress = Math.round(((i + 1) / pages.length) * 100);
-            progressBarEl.style.width = `${verifyProgress}%`;
-            progressTextEl.textContent = `Verifying: ${i + 1}/${pages.length} pages (${verifyProgress}%)`;
         }
 
-        log(`Successfully programmed and verified firmware (${currentProgramData.length} bytes in ${pages.length} pages)`, 'success');
-        
+        log(`Successfully programmed and verified firmware (${currentProgramData.length} bytes in ${pages.length} pages, ${changedPages.length} written)`, 'success');
+
+        // Effective throughput: firmware bytes per second of total programming time (incl. compare and verify)
+        const elapsedSeconds = (performance.now() - startTime) / 1000;
+        const throughput = currentProgramData.length / elapsedSeconds / 1024;
+        log(`Programming took ${elapsedSeconds.toFixed(1)} s (${throughput.toFixed(1)} kB/s effective)`, 'info');
+
         // Show completion and hide after delay
         progressBarEl.classList.remove('program-progress-bar-verify');
         progressBarEl.classList.add('program-progress-bar-complete');
         progressBarEl.style.width = '100%';
         progressTextEl.textContent = 'Complete!';
-        
+
         setTimeout(() => {
             progressDivEl.style.display = 'none';
             progressBarEl.classList.remove('program-progress-bar-complete');
         }, PROGRESS_COMPLETE_DELAY);
-        
+
         // Clear loaded file
         currentProgramData = null;
+        currentDirtyPages = null;
         updateProgramFileButtonState();
     } catch (error) {
         log(`Error programming HEX file: ${handleError(error, 'Unknown error')}`, 'error');
@@ -751,10 +886,50 @@ async function readEepromConfiguration(): Promise<{ config: EepromConfig; isBlan
     }
 }
 
+/**
+ * Find the bytes that differ between two EEPROM images.
+ * Runs of changed bytes are split at EEPROM page boundaries and grouped by page.
+ * @param previous - Bytes currently in EEPROM
+ * @param bytes - Bytes to write
+ * @param address - EEPROM address of the first byte
+ * @returns Changed ranges of each page that needs writing
+ */
+function diffEepromBytes(previous: Uint8Array, bytes: Uint8Array, address: number): NvmRange[][] {
+    const pageSize = selectedDevice.eeprom_page_size!;
+    const pages = new Map<number, NvmRange[]>();
+    const differs = (i: number) => bytes[i] !== previous[i];
+
+    let i = 0;
+    while (i < bytes.length) {
+        if (!differs(i)) {
+            i++;
+            continue;
+        }
+        const start = i;
+        const pageEnd = (Math.floor((address + start) / pageSize) + 1) * pageSize - address;
+        while (i < bytes.length && i < pageEnd && differs(i)) {
+            i++;
+        }
+        const page = Math.floor((address + start) / pageSize);
+        const range = { address: address + start, data: bytes.slice(start, i) };
+        const ranges = pages.get(page);
+        if (ranges) {
+            ranges.push(range);
+        } else {
+            pages.set(page, [range]);
+        }
+    }
+
+    return Array.from(pages.values());
+}
+
 /**
  * Write EEPROM configuration to device and verify.
- * Serializes config to bytes and writes via EEPROM write method.
- * Always reads back to verify data was written correctly.
+ * The configuration block is read from the device right before writing (the firmware may have
+ * changed it since it was last read, e.g. while running for telemetry), and only the bytes that
+ * differ are loaded into the page buffer and written, with one erase/write per EEPROM page, so
+ * unchanged fields are not worn.
+ * Reads back the whole block to verify data was written correctly.
  * @param config - Configuration object to write
  * @throws Error if write or verification fails
  */
@@ -768,18 +943,29 @@ async function writeEepromConfiguration(config: EepromConfig): Promise<void> {
         config.magic = EEPROM_MAGIC;
         
         const bytes = configToEepromBytes(config);
-        await app!.writeEeprom(EEPROM_CONFIG_ADDRESS, bytes);
+        const current = await app!.readData(EEPROM_CONFIG_ADDRESS, EEPROM_CONFIG_SIZE);
+        const pages = diffEepromBytes(current, bytes, EEPROM_CONFIG_ADDRESS);
+
+        if (pages.length === 0) {
+            log('EEPROM configuration is unchanged, nothing to write', 'success');
+            return;
+        }
+
+        for (const ranges of pages) {
+            await app!.writeEepromRanges(ranges);
+        }
         
-        log('EEPROM write complete, verifying...', 'info');
+        const changed = pages.reduce((sum, ranges) => sum + ranges.reduce((n, range) => n + range.data.length, 0), 0);
+        log(`EEPROM write of ${changed} changed byte(s) complete, verifying...`, 'info');
         
-        // Read back and verify
+        // Read back and verify the whole block
         const readBack = await app!.readData(EEPROM_CONFIG_ADDRESS, EEPROM_CONFIG_SIZE);
         for (let i = 0; i < bytes.length; i++) {
             if (readBack[i] !== bytes[i]) {
                 const address = formatHex(EEPROM_CONFIG_ADDRESS + i);
                 const wrote = formatByte(bytes[i]);
                 const read = formatByte(readBack[i]);
-                throw new Error(`EEPROM verification failed at ${address}: wrote ${wrote} but read ${read}`);
+                throw new Error(`EEPROM verification failed at ${address}: expected ${wrote} but read ${read}`);
             }
         }
         
@@ -1107,6 +1293,254 @@ async function handleProgramFuses(): Promise<void> {
     }
 }
 
+/**
+ * Enable/disable buttons while telemetry is running.
+ * The firmware runs during telemetry, so everything that needs programming mode is disabled.
+ */
+function setTelemetryButtons(running: boolean): void {
+    if (running) {
+        const programmingButtons = ['btn-read-eeprom', 'btn-save-eeprom', 'btn-reset-eeprom', 'btn-program-fuses', 'btn-program-file'];
+        for (const id of programmingButtons) {
+            const btn = getElement<HTMLButtonElement>(id);
+            if (btn) btn.disabled = true;
+        }
+    } else {
+        disableConnectionButtons(app !== null);
+    }
+
+    const startBtn = getElement<HTMLButtonElement>('btn-start-telemetry');
+    if (startBtn) startBtn.disabled = running || !app;
+    const stopBtn = getElement<HTMLButtonElement>('btn-stop-telemetry');
+    if (stopBtn) stopBtn.disabled = !running;
+}
+
+/**
+ * Read the telemetry block, retrying if the firmware was updating it during the read
+ * @throws Error if the read fails or there is no telemetry block
+ */
+async function readTelemetrySample(): Promise<TelemetrySample> {
+    for (let attempt = 0; attempt < TELEMETRY_READ_RETRIES; attempt++) {
+        const sample = decodeTelemetry(await app!.readData(TELEMETRY_ADDRESS, TELEMETRY_SIZE));
+        if (sample) {
+            return sample;
+        }
+    }
+    throw new Error('Telemetry is being updated continuously, no consistent read');
+}
+
+/**
+ * Read and display one telemetry sample, then schedule the next one
+ */
+async function pollTelemetry(): Promise<void> {
+    telemetryTimer = null;
+    try {
+        const sample = await readTelemetrySample();
+        telemetryHistory.push(sample);
+        if (telemetryHistory.length > TELEMETRY_HISTORY_LENGTH) {
+            telemetryHistory.shift();
+        }
+        renderTelemetry(sample);
+    } catch (error) {
+        // Unless stopped in the meantime
+        if (telemetryPoll) {
+            log(`Error reading telemetry: ${handleError(error, 'Unknown error')}`, 'error');
+            telemetryPoll = null;
+            await stopTelemetry();
+        }
+        return;
+    }
+    if (telemetryPoll) {
+        telemetryTimer = setTimeout(() => {
+            telemetryPoll = pollTelemetry();
+        }, TELEMETRY_INTERVAL);
+    }
+}
+
+/**
+ * Stop polling telemetry, waiting for a read in progress to finish
+ */
+async function stopTelemetryPolling(): Promise<void> {
+    const poll = telemetryPoll;
+    telemetryPoll = null;
+    if (telemetryTimer) {
+        clearTimeout(telemetryTimer);
+        telemetryTimer = null;
+    }
+    if (poll) {
+        await poll;
+    }
+}
+
+/**
+ * Handle start telemetry button click.
+ * Lets the firmware run and polls its telemetry block over UPDI.
+ */
+async function startTelemetry(): Promise<void> {
+    try {
+        checkConnected();
+        setTelemetryButtons(true);
+
+        log('Leaving programming mode to run the firmware...', 'info');
+        await app!.runTarget();
+        const negotiateCheckbox = getElement<HTMLInputElement>('baud-negotiate');
+        if (negotiateCheckbox?.checked) {
+            await app!.negotiateBaud();
+        }
+
+        telemetryHistory = [];
+        const container = getElement<HTMLDivElement>('telemetry-container');
+        if (container) {
+            container.style.display = 'block';
+        }
+        log('Reading telemetry', 'success');
+        telemetryPoll = pollTelemetry();
+    } catch (error) {
+        log(`Error starting telemetry: ${handleError(error, 'Unknown error')}`, 'error');
+        await stopTelemetry();
+    }
+}
+
+/**
+ * Handle stop telemetry button click.
+ * Stops polling and puts the device back into programming mode.
+ */
+async function stopTelemetry(): Promise<void> {
+    const stopBtn = getElement<HTMLButtonElement>('btn-stop-telemetry');
+    if (stopBtn) stopBtn.disabled = true;
+    await stopTelemetryPolling();
+
+    if (app) {
+        try {
+            log('Entering programming mode...', 'info');
+            await app.enterProgmode();
+            const negotiateCheckbox = getElement<HTMLInputElement>('baud-negotiate');
+            if (negotiateCheckbox?.checked) {
+                await app.negotiateBaud();
+            }
+            log('Entered programming mode', 'success');
+        } catch (error) {
+            log(`Error entering prog mode: ${handleError(error, 'Unknown error')}`, 'error');
+        }
+    }
+    setTelemetryButtons(false);
+}
+
+/**
+ * Hide the telemetry container
+ */
+function hideTelemetry(): void {
+    const container = getElement<HTMLDivElement>('telemetry-container');
+    if (container) {
+        container.style.display = 'none';
+    }
+}
+
+/**
+ * Render the latest telemetry sample and the plots of the history
+ */
+function renderTelemetry(sample: TelemetrySample): void {
+    const table = getElement<HTMLTableElement>('telemetry-values');
+    if (table) {
+        // Wakeup rate over the history (the counter wraps around at 65536)
+        const first = telemetryHistory[0];
+        const elapsed = sample.uptime - first.uptime;
+        const wakesPerMinute = elapsed > 0 ? ((sample.wakes - first.wakes) & 0xFFFF) / elapsed * 60 : 0;
+
+        const rows: [string, string][] = [
+            ['Charger state', stateName(CHARGER_STATE_NAMES, sample.chargerState)],
+            ['PD connection state', stateName(PD_CONN_STATE_NAMES, sample.pdConnState)],
+            ['PD policy state', stateName(PD_POLICY_STATE_NAMES, sample.pdPolicyState)],
+            ['VBUS / IBUS', `${sample.vbus} mV / ${sample.ibus} mA`],
+            ['VAC1 / VAC2', `${sample.vac1} mV / ${sample.vac2} mV`],
+            ['VBAT / IBAT', `${sample.vbat} mV / ${sample.ibat} mA`],
+            ['Charger die / thermistor', `${sample.tdie} °C / ${sample.ts}`],
+            ['Thermal derating', `${sample.thermalDerating} %`],
+            ['OTG voltage / current', `${sample.otgVoltage} mV / ${sample.otgCurrent} mA`],
+            ['OTG compensation', `${sample.otgCompensation} mV (path ${sample.otgPathResistance} mΩ)`],
+            ['Uptime', `${Math.floor(sample.uptime)} s`],
+            ['Wakeups', `${sample.wakes} (${wakesPerMinute.toFixed(1)}/min)`],
+            ['Last reset', `${formatResetFlags(sample.resetFlags)} (${sample.warmResets} warm resets)`],
+            ['Fault retries', `${sample.faultRetryCount}`],
+        ];
+        for (const fault of sample.faults) {
+            rows.push([`Fault at ${Math.floor(fault.uptime)} s`, `${formatFaultStatus(fault.status)} in ${stateName(CHARGER_STATE_NAMES, fault.state)}`]);
+        }
+
+        table.replaceChildren(...rows.map(([name, value]) => {
+            const row = document.createElement('tr');
+            const nameCell = document.createElement('th');
+            nameCell.textContent = name;
+            const valueCell = document.createElement('td');
+            valueCell.textContent = value;
+            row.append(nameCell, valueCell);
+            return row;
+        }));
+    }
+
+    drawTelemetryPlot('telemetry-plot-voltage', 'V', [
+        { label: 'VBUS', color: '#007bff', values: telemetryHistory.map((s) => s.vbus / 1000) },
+        { label: 'VBAT', color: '#28a745', values: telemetryHistory.map((s) => s.vbat / 1000) },
+    ]);
+    drawTelemetryPlot('telemetry-plot-current', 'A', [
+        { label: 'IBUS', color: '#007bff', values: telemetryHistory.map((s) => s.ibus / 1000) },
+        { label: 'IBAT', color: '#28a745', values: telemetryHistory.map((s) => s.ibat / 1000) },
+    ]);
+}
+
+/**
+ * Draw a line plot of telemetry values, scaled to fit, newest at the right
+ */
+function drawTelemetryPlot(canvasId: string, unit: string, series: { label: string; color: string; values: number[] }[]): void {
+    const canvas = getElement<HTMLCanvasElement>(canvasId);
+    const ctx = canvas?.getContext('2d');
+    if (!canvas || !ctx) return;
+
+    const width = canvas.width;
+    const height = canvas.height;
+    const margin = 20;
+    ctx.clearRect(0, 0, width, height);
+
+    const all = series.flatMap((s) => s.values);
+    let min = Math.min(0, ...all);
+    let max = Math.max(...all);
+    if (!(max > min)) {
+        max = min + 1;
+    }
+    const x = (i: number) => width - 1 - (TELEMETRY_HISTORY_LENGTH - 1 - i) * (width - 1) / (TELEMETRY_HISTORY_LENGTH - 1);
+    const y = (value: number) => height - margin - (value - min) / (max - min) * (height - 2 * margin);
+
+    // Zero line and scale
+    ctx.strokeStyle = '#dee2e6';
+    ctx.beginPath();
+    ctx.moveTo(0, y(0));
+    ctx.lineTo(width, y(0));
+    ctx.stroke();
+    ctx.fillStyle = '#6c757d';
+    ctx.font = '11px sans-serif';
+    ctx.fillText(`${max.toFixed(2)} ${unit}`, 2, margin - 6);
+    ctx.fillText(`${min.toFixed(2)} ${unit}`, 2, height - 4);
+
+    let legendX = width / 2;
+    for (const s of series) {
+        const offset = TELEMETRY_HISTORY_LENGTH - s.values.length;
+        ctx.strokeStyle = s.color;
+        ctx.beginPath();
+        s.values.forEach((value, i) => {
+            if (i === 0) {
+                ctx.moveTo(x(offset + i), y(value));
+            } else {
+                ctx.lineTo(x(offset + i), y(value));
+            }
+        });
+        ctx.stroke();
+
+        const latest = s.values.length > 0 ? s.values[s.values.length - 1].toFixed(2) : '-';
+        ctx.fillStyle = s.color;
+        ctx.fillText(`${s.label} ${latest} ${unit}`, legendX, margin - 6);
+        legendX += 100;
+    }
+}
+
 /**
  * Check if the browser supports the Web Serial API
  */
@@ -1145,7 +1579,9 @@ export function initializeUI(): void {
         programFileBtn: getElement<HTMLButtonElement>('btn-program-file'),
         saveEepromBtn: getElement<HTMLButtonElement>('btn-save-eeprom'),
         resetEepromBtn: getElement<HTMLButtonElement>('btn-reset-eeprom'),
-        programFusesBtn: getElement<HTMLButtonElement>('btn-program-fuses')
+        programFusesBtn: getElement<HTMLButtonElement>('btn-program-fuses'),
+        startTelemetryBtn: getElement<HTMLButtonElement>('btn-start-telemetry'),
+        stopTelemetryBtn: getElement<HTMLButtonElement>('btn-stop-telemetry')
     };
     
     if (elements.connectBtn) elements.connectBtn.addEventListener('click', connectSerial);
@@ -1157,6 +1593,8 @@ export function initializeUI(): void {
     if (elements.saveEepromBtn) elements.saveEepromBtn.addEventListener('click', handleSaveEepromConfiguration);
     if (elements.resetEepromBtn) elements.resetEepromBtn.addEventListener('click', handleResetEepromConfiguration);
     if (elements.programFusesBtn) elements.programFusesBtn.addEventListener('click', handleProgramFuses);
+    if (elements.startTelemetryBtn) elements.startTelemetryBtn.addEventListener('click', startTelemetry);
+    if (elements.stopTelemetryBtn) elements.stopTelemetryBtn.addEventListener('click', stopTelemetry);
         
     // Log initialization message
     log('KXUSBC2 Programmer initialized and ready', 'info');
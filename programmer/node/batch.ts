@@ -0,0 +1,334 @@
+/**
+ * Batch production programming
+ *
+ * Brings up a board in a fixed sequence of stages: fuses, EEPROM, flash, RTC calibration and
+ * a final verification of everything written. Each stage only writes what differs from the
+ * device, so a board can be run through the pipeline again after a failure. The CLI runs one
+ * pipeline per UPDI adapter concurrently, each with its own UpdiApplication.
+ */
+
+import { readFile } from "node:fs/promises";
+import { UpdiApplication } from "../serialupdi/application.js";
+import { NvmRange } from "../serialupdi/nvm.js";
+import { ATTINY3226_DEVICE } from "../devices.js";
+import { HexParseResult, parseHexFile } from "../intel-hex-parser.js";
+import {
+  FlashImage, buildFlashImage, flashImagePages, isFlashImageInstalled, runCrcScan, verifyFlashByReadBack,
+} from "../flash-image.js";
+
+// User row layout (see firmware/src/userrow.h)
+const USERROW_MAGIC = 0x5255;
+const RTC_NOMINAL_FREQUENCY = 512;      // Hz, output of the calibration firmware on PA2
+const RTC_OFFSET_LIMIT = 127;           // ppm
+
+const FUSES_FILE_SIZE = 0x10;
+
+export interface BatchImages {
+  flash?: HexParseResult;
+  eeprom?: HexParseResult;
+  fuses?: HexParseResult;
+  frequencies?: Map<string, number>;    // Measured RTC frequency (Hz) by board name
+}
+
+export type StageResult = string;       // Short summary for the report, e.g. "3/5 pages"
+
+export interface BoardReport {
+  board: string;
+  stages: Map<string, StageResult>;
+  rtcOffset?: number;                   // ppm
+  time: number;                         // ms
+  error?: string;
+}
+
+export const BATCH_STAGES = ['Fuses', 'EEPROM', 'Flash', 'RTC calibration', 'Verify'];
+
+/**
+ * Load the files for a batch, parsed into images of the respective memories
+ */
+export async function loadBatchImages(files: { flash?: string; eeprom?: string; fuses?: string; frequencies?: string }): Promise<BatchImages> {
+  const device = ATTINY3226_DEVICE;
+  const images: BatchImages = {};
+  if (files.flash) {
+    images.flash = await parseHexFile(await readFile(files.flash, 'utf8'), {
+      imageSize: device.flash_size,
+      pageSize: device.flash_page_size,
+    });
+  }
+  if (files.eeprom) {
+    images.eeprom = await parseHexFile(await readFile(files.eeprom, 'utf8'), {
+      imageSize: device.eeprom_size,
+      pageSize: device.eeprom_page_size,
+    });
+  }
+  if (files.fuses) {
+    // avrdude's fuses memory extends past the fuses into reserved bytes (e.g. firmware/fuses.hex
+    // has 10 bytes), which are ignored
+    const fuses = await parseHexFile(await readFile(files.fuses, 'utf8'), { imageSize: FUSES_FILE_SIZE });
+    images.fuses = { ...fuses, data: fuses.data.subarray(0, device.fuses_size) };
+  }
+  if (files.frequencies) {
+    images.frequencies = parseFrequencies(await readFile(files.frequencies, 'utf8'));
+  }
+  return images;
+}
+
+/**
+ * Parse a file of measured RTC frequencies: one "<board> <frequency in Hz>" per line, where the
+ * board is the serial port of its UPDI adapter. Empty lines and lines starting with # are ignored.
+ */
+export function parseFrequencies(content: string): Map<string, number> {
+  const frequencies = new Map<string, number>();
+  const lines = content.split(/\r?\n/);
+  for (let i = 0; i < lines.length; i++) {
+    const line = lines[i].trim();
+    if (line === '' || line.startsWith('#')) {
+      continue;
+    }
+    const fields = line.split(/[\s,;]+/);
+    const frequency = parseFloat(fields[1]);
+    if (fields.length !== 2 || !(frequency > 0)) {
+      throw new Error(`Invalid frequency in line ${i + 1}`);
+    }
+    frequencies.set(fields[0], frequency);
+  }
+  return frequencies;
+}
+
+/**
+ * Calculate the factory RTC offset from the frequency measured with the calibration firmware
+ * (same calculation as firmware/rtc_calib.sh)
+ * @returns offset in ppm, clamped to the range of the user row field
+ */
+export function rtcOffsetFromFrequency(frequency: number): number {
+  const offset = Math.round(1000000 * (frequency / RTC_NOMINAL_FREQUENCY - 1));
+  return Math.max(-RTC_OFFSET_LIMIT, Math.min(RTC_OFFSET_LIMIT, offset));
+}
+
+/**
+ * Group the bytes of an image that differ from the device into runs, one list per page
+ * @param image data from the file, starting at offset 0 of the memory
+ * @param from first offset with data in the file
+ */
+function changedRanges(current: Uint8Array, image: Uint8Array, from: number, address: number, pageSize: number): NvmRange[][] {
+  const pages: NvmRange[][] = [];
+  let ranges: NvmRange[] = [];
+  let page = -1;
+  let start = -1;
+  for (let offset = from; offset <= image.length; offset++) {
+    const changed = offset < image.length && current[offset] !== image[offset];
+    const newPage = Math.floor(offset / pageSize) !== page;
+    if (start >= 0 && (!changed || newPage)) {
+      ranges.push({ address: address + start, data: image.slice(start, offset) });
+      start = -1;
+    }
+    if (newPage) {
+      if (ranges.length > 0) {
+        pages.push(ranges);
+      }
+      ranges = [];
+      page = Math.floor(offset / pageSize);
+    }
+    if (changed && start < 0) {
+      start = offset;
+    }
+  }
+  if (ranges.length > 0) {
+    pages.push(ranges);
+  }
+  return pages;
+}
+
+/**
+ * Read back a memory area and compare with the expected data
+ */
+async function verifyData(app: UpdiApplication, address: number, expected: Uint8Array, name: string): Promise<void> {
+  const readBack = await app.readData(address, expected.length);
+  for (let i = 0; i < expected.length; i++) {
+    if (readBack[i] !== expected[i]) {
+      throw new Error(`${name} verification failed at 0x${(address + i).toString(16)}`);
+    }
+  }
+}
+
+export interface FlashProgramResult {
+  image: FlashImage;
+  pages: number;                        // Pages of the image
+  written: number[];                    // Addresses of the pages written
+}
+
+/**
+ * Write the pages of a flash image that differ from the device, like the web programmer: the
+ * image is the whole flash with the checksum for CRCSCAN in its last two bytes. Pages beyond
+ * the end of the firmware are left as they are until verifyFlash() finds them stale.
+ */
+export async function programFlash(app: UpdiApplication, firmware: HexParseResult): Promise<FlashProgramResult> {
+  const flashAddress = ATTINY3226_DEVICE.flash_address!;
+  const pageSize = ATTINY3226_DEVICE.flash_page_size!;
+  const image = buildFlashImage(firmware.data);
+  const pages = flashImagePages(image);
+  const result: FlashProgramResult = { image, pages: pages.length, written: [] };
+  if (await isFlashImageInstalled(app, image)) {
+    return result;
+  }
+
+  for (const page of pages) {
+    const address = flashAddress + page * pageSize;
+    const data = image.data.slice(page * pageSize, (page + 1) * pageSize);
+    const current = await app.readData(address, pageSize);
+    if (!current.every((byte, i) => byte === data[i])) {
+      await app.eraseWriteFlashPage(address, data);
+      result.written.push(address);
+    }
+  }
+  return result;
+}
+
+/**
+ * Verify the flash after programFlash(): on-chip with CRCSCAN, falling back to reading back the
+ * flash on a mismatch (which also rewrites stale pages beyond the end of the firmware)
+ * @returns number of stale pages rewritten
+ */
+export async function verifyFlash(app: UpdiApplication, result: FlashProgramResult): Promise<number> {
+  const { image, written } = result;
+  if (!image.hasChecksum) {
+    // No room for the checksum - read back the written pages (unchanged pages have just been compared)
+    const flashAddress = ATTINY3226_DEVICE.flash_address!;
+    const pageSize = ATTINY3226_DEVICE.flash_page_size!;
+    for (const address of written) {
+      const offset = address - flashAddress;
+      await verifyData(app, address, image.data.subarray(offset, offset + pageSize), 'Flash');
+    }
+    return 0;
+  }
+  if (await runCrcScan(app)) {
+    return 0;
+  }
+  const rewritten = await verifyFlashByReadBack(app, image, new Set(written));
+  if (!await runCrcScan(app)) {
+    throw new Error('CRCSCAN verification failed after read-back');
+  }
+  return rewritten;
+}
+
+async function programFuses(app: UpdiApplication, image: HexParseResult): Promise<StageResult> {
+  const fusesAddress = ATTINY3226_DEVICE.fuses_address!;
+  const current = await app.readData(fusesAddress, ATTINY3226_DEVICE.fuses_size!);
+  let written = 0;
+  for (let i = image.address; i < image.data.length; i++) {
+    if (current[i] !== image.data[i]) {
+      await app.writeFuse(fusesAddress + i, image.data.subarray(i, i + 1));
+      written++;
+    }
+  }
+  return `${written}/${image.data.length - image.address} bytes`;
+}
+
+async function programEeprom(app: UpdiApplication, image: HexParseResult): Promise<StageResult> {
+  const eepromAddress = ATTINY3226_DEVICE.eeprom_address!;
+  const current = await app.readData(eepromAddress, image.data.length);
+  const pages = changedRanges(current, image.data, image.address, eepromAddress, ATTINY3226_DEVICE.eeprom_page_size!);
+  let written = 0;
+  for (const ranges of pages) {
+    await app.writeEepromRanges(ranges);
+    written += ranges.reduce((sum, range) => sum + range.data.length, 0);
+  }
+  return `${written}/${image.data.length - image.address} bytes`;
+}
+
+/**
+ * Write the factory RTC offset to the user row, unless it already contains it
+ */
+async function programUserRow(app: UpdiApplication, offset: number): Promise<StageResult> {
+  const userRowAddress = ATTINY3226_DEVICE.user_row_address!;
+  const data = new Uint8Array([USERROW_MAGIC & 0xff, USERROW_MAGIC >> 8, offset & 0xff]);
+  const current = await app.readData(userRowAddress, data.length);
+  if (current.every((byte, i) => byte === data[i])) {
+    return `${offset} ppm (unchanged)`;
+  }
+  await app.writeUserRow(userRowAddress, data);
+  return `${offset} ppm`;
+}
+
+/**
+ * Run a board that is in programming mode through all stages of the pipeline. Stages without
+ * an image are skipped. Stops at the first error, which is recorded in the report.
+ * @param app connected UPDI application
+ * @param board name of the board (serial port of its adapter)
+ * @param images images to program
+ */
+export async function programBoard(app: UpdiApplication, board: string, images: BatchImages): Promise<BoardReport> {
+  const report: BoardReport = { board, stages: new Map(), time: 0 };
+  const start = performance.now();
+  const frequency = images.frequencies?.get(board);
+  try {
+    if (images.fuses) {
+      report.stages.set('Fuses', await programFuses(app, images.fuses));
+    }
+    if (images.eeprom) {
+      report.stages.set('EEPROM', await programEeprom(app, images.eeprom));
+    }
+    let flash: FlashProgramResult | undefined;
+    if (images.flash) {
+      flash = await programFlash(app, images.flash);
+      report.stages.set('Flash', `${flash.written.length}/${flash.pages} pages`);
+    }
+    if (frequency !== undefined) {
+      report.rtcOffset = rtcOffsetFromFrequency(frequency);
+      report.stages.set('RTC calibration', await programUserRow(app, report.rtcOffset));
+    } else if (images.frequencies) {
+      report.stages.set('RTC calibration', 'no measurement');
+    }
+
+    // Read back everything that was programmed, also what was skipped as unchanged (the flash
+    // is checked with CRCSCAN)
+    const device = ATTINY3226_DEVICE;
+    if (images.fuses) {
+      const { data, address } = images.fuses;
+      await verifyData(app, device.fuses_address! + address, data.subarray(address), 'Fuse');
+    }
+    if (images.eeprom) {
+      const { data, address } = images.eeprom;
+      await verifyData(app, device.eeprom_address! + address, data.subarray(address), 'EEPROM');
+    }
+    let verify = 'OK';
+    if (flash) {
+      const rewritten = await verifyFlash(app, flash);
+      if (rewritten > 0) {
+        verify = `OK (${rewritten} stale pages)`;
+      }
+    }
+    if (report.rtcOffset !== undefined) {
+      const offset = report.rtcOffset;
+      const expected = new Uint8Array([USERROW_MAGIC & 0xff, USERROW_MAGIC >> 8, offset & 0xff]);
+      await verifyData(app, device.user_row_address!, expected, 'User row');
+    }
+    report.stages.set('Verify', verify);
+  } catch (error) {
+    report.error = error instanceof Error ? error.message : String(error);
+  }
+  report.time = performance.now() - start;
+  return report;
+}
+
+/**
+ * Format the reports of a batch as a table, one line per board
+ */
+export function formatReports(reports: BoardReport[]): string {
+  const width = Math.max(8, ...reports.map((report) => report.board.length + 2));
+  const stageWidths = BATCH_STAGES.map((stage) => Math.max(stage.length + 2,
+    ...reports.map((report) => (report.stages.get(stage) ?? '').length + 2)));
+  const lines = [
+    'Board'.padEnd(width) + BATCH_STAGES.map((stage, i) => stage.padEnd(stageWidths[i])).join('') + 'Time [s]  Result',
+  ];
+  for (const report of reports) {
+    lines.push(
+      report.board.padEnd(width) +
+      BATCH_STAGES.map((stage, i) => (report.stages.get(stage) ?? '-').padEnd(stageWidths[i])).join('') +
+      (report.time / 1000).toFixed(2).padStart(8) + '  ' +
+      (report.error ? `FAILED: ${report.error}` : 'OK')
+    );
+  }
+  const failed = reports.filter((report) => report.error).length;
+  lines.push(`${reports.length - failed} of ${reports.length} boards OK`);
+  return lines.join('\n');
+}
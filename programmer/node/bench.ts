@@ -0,0 +1,139 @@
+/**
+ * Benchmark suite for the UPDI stack
+ *
+ * Times connecting, erasing, writing and verifying flash, EEPROM and fuses end to end through
+ * a connected UpdiApplication, and checks the results by reading back. Overwrites the whole
+ * flash, EEPROM and fuses, so only run it on a simulated target or a spare device.
+ */
+
+import { UpdiApplication } from "../serialupdi/application.js";
+import { ATTINY3226_DEVICE } from "../devices.js";
+
+export interface BenchResult {
+  name: string;
+  bytes: number;
+  time: number;       // ms
+}
+
+/**
+ * Run a benchmark and record its result
+ */
+export async function measure(results: BenchResult[], name: string, bytes: number, fn: () => Promise<void>): Promise<void> {
+  const start = performance.now();
+  await fn();
+  results.push({ name, bytes, time: performance.now() - start });
+}
+
+/**
+ * Deterministic pseudo-random test pattern (so runs are comparable)
+ */
+function testPattern(size: number, seed: number): Uint8Array {
+  const data = new Uint8Array(size);
+  let x = seed || 1;
+  for (let i = 0; i < size; i++) {
+    x ^= x << 13;
+    x ^= x >>> 17;
+    x ^= x << 5;
+    data[i] = x & 0xff;
+  }
+  return data;
+}
+
+/**
+ * Read back a memory area page by page and compare with the expected data
+ */
+async function verify(app: UpdiApplication, address: number, expected: Uint8Array, pageSize: number): Promise<void> {
+  for (let offset = 0; offset < expected.length; offset += pageSize) {
+    const page = expected.subarray(offset, offset + pageSize);
+    const readBack = await app.readData(address + offset, page.length);
+    for (let i = 0; i < page.length; i++) {
+      if (readBack[i] !== page[i]) {
+        throw new Error(`Verification failed at 0x${(address + offset + i).toString(16)}`);
+      }
+    }
+  }
+}
+
+/**
+ * Run all benchmarks on a device that is in programming mode
+ * @param app connected UPDI application
+ * @param results results to append to
+ * @returns results, in the order run
+ */
+export async function runBenchmarks(app: UpdiApplication, results: BenchResult[] = []): Promise<BenchResult[]> {
+  const device = ATTINY3226_DEVICE;
+  const flashAddress = device.flash_address!;
+  const flashSize = device.flash_size!;
+  const flashPageSize = device.flash_page_size!;
+  const eepromAddress = device.eeprom_address!;
+  const eepromSize = device.eeprom_size!;
+  const eepromPageSize = device.eeprom_page_size!;
+  const fusesAddress = device.fuses_address!;
+
+  const flashData = testPattern(flashSize, 1);
+  const flashData2 = testPattern(flashSize, 2);
+  const eepromData = testPattern(eepromSize, 3);
+  const fuses = await app.readData(fusesAddress, device.fuses_size!);
+
+  await measure(results, 'Chip erase', flashSize, () => app.chipErase());
+
+  await measure(results, 'Flash write (erased)', flashSize, async () => {
+    for (let offset = 0; offset < flashSize; offset += flashPageSize) {
+      await app.writeFlash(flashAddress + offset, flashData.subarray(offset, offset + flashPageSize));
+    }
+  });
+
+  await measure(results, 'Flash verify', flashSize, () => verify(app, flashAddress, flashData, flashPageSize));
+
+  await measure(results, 'Flash page erase', flashSize, async () => {
+    for (let offset = 0; offset < flashSize; offset += flashPageSize) {
+      await app.eraseFlashPage(flashAddress + offset);
+    }
+  });
+
+  await measure(results, 'Flash erase/write', flashSize, async () => {
+    for (let offset = 0; offset < flashSize; offset += flashPageSize) {
+      await app.eraseWriteFlashPage(flashAddress + offset, flashData2.subarray(offset, offset + flashPageSize));
+    }
+  });
+
+  await measure(results, 'Flash verify', flashSize, () => verify(app, flashAddress, flashData2, flashPageSize));
+
+  await measure(results, 'EEPROM write', eepromSize, async () => {
+    for (let offset = 0; offset < eepromSize; offset += eepromPageSize) {
+      await app.writeEeprom(eepromAddress + offset, eepromData.subarray(offset, offset + eepromPageSize));
+    }
+  });
+
+  await measure(results, 'EEPROM verify', eepromSize, () => verify(app, eepromAddress, eepromData, eepromPageSize));
+
+  // Write the fuses back with their previous values
+  await measure(results, 'Fuse write', fuses.length, async () => {
+    for (let i = 0; i < fuses.length; i++) {
+      await app.writeFuse(fusesAddress + i, fuses.subarray(i, i + 1));
+    }
+  });
+
+  await measure(results, 'Fuse verify', fuses.length, () => verify(app, fusesAddress, fuses, fuses.length));
+
+  return results;
+}
+
+/**
+ * Format results as a table
+ */
+export function formatResults(results: BenchResult[]): string {
+  const lines = ['Benchmark                   Bytes    Time [ms]    kB/s'];
+  for (const result of results) {
+    const rate = result.time > 0 ? (result.bytes / 1024) / (result.time / 1000) : 0;
+    lines.push(
+      result.name.padEnd(24) +
+      result.bytes.toString().padStart(9) +
+      result.time.toFixed(1).padStart(13) +
+      rate.toFixed(2).padStart(8)
+    );
+  }
+  const total = results.reduce((sum, result) => sum + result.time, 0);
+  lines.push('Total'.padEnd(33) + total.toFixed(1).padStart(13));
+  return lines.join('\n');
+}
@@ -0,0 +1,294 @@
+/**
+ * Command line programmer for the KXUSBC2
+ *
+ * Runs the same UPDI stack as the web programmer under Node.js, either on a UPDI adapter
+ * (using the 'serialport' package) or on a simulated ATtiny3226, e.g. to benchmark the
+ * programmer without hardware. In batch mode, it programs and calibrates several boards on
+ * separate adapters concurrently.
+ */
+
+import { readFile } from "node:fs/promises";
+import { UpdiApplication } from "../serialupdi/application.js";
+import { UpdiSerialPort } from "../serialupdi/physical.js";
+import { ATTINY3226_DEVICE } from "../devices.js";
+import { parseHexFile } from "../intel-hex-parser.js";
+import { SimulatedSerialPort, SimulatedTarget } from "./simulator.js";
+import { NodeSerialPort } from "./serialport.js";
+import { BenchResult, formatResults, measure, runBenchmarks } from "./bench.js";
+import { BoardReport, formatReports, loadBatchImages, programBoard, programFlash, verifyFlash } from "./batch.js";
+
+const DEVICE_ID_ADDRESS = 0x1100;
+const NVMCTRL_ADDRESS = 0x1000;
+const DEFAULT_BAUD = 115200;
+const DEFAULT_TIMEOUT = 1000;           // milliseconds
+
+const USAGE = `Usage: kxusbc2-cli [options] <command> [file]
+
+Commands:
+  info              Show device information and fuses
+  program <file>    Program an Intel HEX file to flash (only pages that differ)
+  read-eeprom       Dump the EEPROM
+  bench             Run the benchmark suite (overwrites flash, EEPROM and fuses!)
+  batch [file]      Program fuses, EEPROM, flash and RTC calibration on all boards, then verify
+
+Options:
+  --port <path>     Serial port of the UPDI adapter (default: simulated target);
+                    can be given several times for batch programming
+  --fuses <file>    Fuses to program in batch mode (e.g. firmware/fuses.hex)
+  --eeprom <file>   EEPROM contents to program in batch mode (.eep file)
+  --frequencies <file>
+                    RTC frequencies measured with the calibration firmware in batch mode,
+                    one "<port> <Hz>" per line
+  --boards <n>      Number of simulated boards in batch mode (default: 1)
+  --baud <rate>     Initial baud rate (default: ${DEFAULT_BAUD})
+  --no-negotiate    Do not negotiate a higher baud rate
+  --no-burst        Write blocks with ACK checking instead of as a single burst
+  --latency <ms>    USB latency of the simulated adapter (default: 1)
+  --runs <n>        Number of benchmark runs (default: 1)
+  --allow-hardware  Allow running the benchmark on a real device
+`;
+
+interface CliOptions {
+  command: string;
+  file?: string;
+  ports: string[];
+  fuses?: string;
+  eeprom?: string;
+  frequencies?: string;
+  boards: number;
+  baud: number;
+  negotiate: boolean;
+  burst: boolean;
+  latency?: number;
+  runs: number;
+  allowHardware: boolean;
+}
+
+/**
+ * Parse the command line
+ */
+function parseArgs(args: string[]): CliOptions {
+  const options: CliOptions = {
+    command: '',
+    ports: [],
+    boards: 1,
+    baud: DEFAULT_BAUD,
+    negotiate: true,
+    burst: true,
+    runs: 1,
+    allowHardware: false,
+  };
+  const positional: string[] = [];
+
+  for (let i = 0; i < args.length; i++) {
+    const arg = args[i];
+    const value = () => {
+      if (i + 1 >= args.length) {
+        throw new Error(`Missing value for ${arg}`);
+      }
+      return args[++i];
+    };
+    switch (arg) {
+      case '--port':
+        options.ports.push(value());
+        break;
+      case '--fuses':
+        options.fuses = value();
+        break;
+      case '--eeprom':
+        options.eeprom = value();
+        break;
+      case '--frequencies':
+        options.frequencies = value();
+        break;
+      case '--boards':
+        options.boards = parseInt(value(), 10);
+        break;
+      case '--baud':
+        options.baud = parseInt(value(), 10);
+        break;
+      case '--no-negotiate':
+        options.negotiate = false;
+        break;
+      case '--no-burst':
+        options.burst = false;
+        break;
+      case '--latency':
+        options.latency = parseFloat(value());
+        break;
+      case '--runs':
+        options.runs = parseInt(value(), 10);
+        break;
+      case '--allow-hardware':
+        options.allowHardware = true;
+        break;
+      default:
+        if (arg.startsWith('--')) {
+          throw new Error(`Unknown option ${arg}`);
+        }
+        positional.push(arg);
+    }
+  }
+
+  options.command = positional[0] ?? '';
+  options.file = positional[1];
+  return options;
+}
+
+/**
+ * Connect to the device and enter programming mode
+ */
+async function connect(port: UpdiSerialPort, options: CliOptions, results: BenchResult[] = []): Promise<UpdiApplication> {
+  const app = new UpdiApplication(port, options.baud, { nvmctrlAddress: NVMCTRL_ADDRESS }, DEFAULT_TIMEOUT);
+  app.setBurstWrites(options.burst);
+  await measure(results, 'Connect', 0, async () => {
+    await app.init();
+    const deviceInfo = await app.readDeviceInfo();
+    if (!deviceInfo) {
+      throw new Error('Failed to read device info');
+    }
+    if (options.negotiate) {
+      await app.negotiateBaud();
+    }
+    await app.enterProgmode();
+  });
+
+  const deviceIdBytes = await app.readData(DEVICE_ID_ADDRESS, 3);
+  const deviceId = (deviceIdBytes[0] << 16) | (deviceIdBytes[1] << 8) | deviceIdBytes[2];
+  if (deviceId !== ATTINY3226_DEVICE.device_id) {
+    throw new Error(`Unexpected device ID 0x${deviceId.toString(16)}`);
+  }
+  return app;
+}
+
+async function info(app: UpdiApplication): Promise<void> {
+  const fuses = await app.readData(ATTINY3226_DEVICE.fuses_address!, ATTINY3226_DEVICE.fuses_size!);
+  console.log(`Device: ATtiny3226, fuses: ${Array.from(fuses, (b) => b.toString(16).padStart(2, '0')).join(' ')}`);
+}
+
+async function program(app: UpdiApplication, file: string): Promise<void> {
+  const result = await parseHexFile(await readFile(file, 'utf8'), {
+    imageSize: ATTINY3226_DEVICE.flash_size,
+    pageSize: ATTINY3226_DEVICE.flash_page_size,
+  });
+
+  const start = performance.now();
+  const flash = await programFlash(app, result);
+  await verifyFlash(app, flash);
+  const seconds = (performance.now() - start) / 1000;
+  console.log(`Programmed ${flash.written.length} of ${flash.pages} pages in ${seconds.toFixed(2)} s`);
+}
+
+async function readEeprom(app: UpdiApplication): Promise<void> {
+  const address = ATTINY3226_DEVICE.eeprom_address!;
+  const data = await app.readData(address, ATTINY3226_DEVICE.eeprom_size!);
+  for (let offset = 0; offset < data.length; offset += 16) {
+    const line = Array.from(data.subarray(offset, offset + 16), (b) => b.toString(16).padStart(2, '0')).join(' ');
+    console.log(`${(address + offset).toString(16).padStart(4, '0')}: ${line}`);
+  }
+}
+
+/**
+ * Run every board through the batch pipeline, each on its own adapter and UpdiApplication,
+ * all boards concurrently
+ * @returns true if all boards passed
+ */
+async function batch(options: CliOptions): Promise<boolean> {
+  const images = await loadBatchImages({
+    flash: options.file,
+    eeprom: options.eeprom,
+    fuses: options.fuses,
+    frequencies: options.frequencies,
+  });
+  const boards = options.ports.length > 0 ?
+    options.ports.map((path) => ({ name: path, port: (): UpdiSerialPort => new NodeSerialPort(path) })) :
+    Array.from({ length: Math.max(1, options.boards) }, (_, i) => ({
+      name: `sim${i}`,
+      port: (): UpdiSerialPort => new SimulatedSerialPort(new SimulatedTarget(options.latency !== undefined ? { usbLatency: options.latency } : {})),
+    }));
+
+  const reports = await Promise.all(boards.map(async (board): Promise<BoardReport> => {
+    const start = performance.now();
+    let app: UpdiApplication | null = null;
+    try {
+      app = await connect(board.port(), options);
+      const report = await programBoard(app, board.name, images);
+      if (!report.error) {
+        // Reset the device to start the new firmware
+        await app.leaveProgmode();
+      }
+      report.time = performance.now() - start;
+      return report;
+    } catch (error) {
+      return {
+        board: board.name,
+        stages: new Map(),
+        time: performance.now() - start,
+        error: error instanceof Error ? error.message : String(error),
+      };
+    } finally {
+      await app?.destroy();
+    }
+  }));
+
+  console.log(formatReports(reports));
+  return reports.every((report) => !report.error);
+}
+
+async function main(): Promise<void> {
+  const options = parseArgs(process.argv.slice(2));
+  if (!['info', 'program', 'read-eeprom', 'bench', 'batch'].includes(options.command) ||
+      (options.command === 'program' && !options.file)) {
+    console.error(USAGE);
+    process.exit(2);
+  }
+  if (options.command !== 'batch' && options.ports.length > 1) {
+    throw new Error('Multiple ports are only supported in batch mode');
+  }
+  if (options.command === 'bench' && options.ports.length > 0 && !options.allowHardware) {
+    throw new Error('The benchmark overwrites the device; use --allow-hardware to run it on a real device');
+  }
+  if (options.command === 'batch') {
+    if (!await batch(options)) {
+      process.exit(1);
+    }
+    return;
+  }
+
+  const runs = options.command === 'bench' ? Math.max(1, options.runs) : 1;
+  for (let run = 0; run < runs; run++) {
+    const port = options.ports.length > 0 ?
+      new NodeSerialPort(options.ports[0]) :
+      new SimulatedSerialPort(new SimulatedTarget(options.latency !== undefined ? { usbLatency: options.latency } : {}));
+    const results: BenchResult[] = [];
+    const app = await connect(port, options, results);
+    try {
+      switch (options.command) {
+        case 'info':
+          await info(app);
+          break;
+        case 'program':
+          await program(app, options.file!);
+          break;
+        case 'read-eeprom':
+          await readEeprom(app);
+          break;
+        case 'bench':
+          await runBenchmarks(app, results);
+          if (runs > 1) {
+            console.log(`Run ${run + 1} of ${runs}`);
+          }
+          console.log(formatResults(results));
+          break;
+      }
+      await app.leaveProgmode();
+    } finally {
+      await app.destroy();
+    }
+  }
+}
+
+main().catch((error) => {
+  console.error(`Error: ${error instanceof Error ? error.message : error}`);
+  process.exit(1);
+});
@@ -0,0 +1,86 @@
+/**
+ * UpdiSerialPort on top of the Node.js 'serialport' package, for using a UPDI adapter from
+ * the command line. The package is not needed by the web programmer and therefore not a
+ * dependency; install it separately (npm install --no-save serialport) to use real hardware.
+ */
+
+import { UpdiSerialPort } from "../serialupdi/physical.js";
+
+export class NodeSerialPort implements UpdiSerialPort {
+  readable: ReadableStream<Uint8Array> | null = null;
+  writable: WritableStream<Uint8Array> | null = null;
+
+  private path: string;
+  private port: any = null;
+  private controller: ReadableStreamDefaultController<Uint8Array> | null = null;
+
+  /**
+   * @param path serial port device (e.g. /dev/ttyUSB0 or COM3)
+   */
+  constructor(path: string) {
+    this.path = path;
+  }
+
+  async open(options: SerialOptions): Promise<void> {
+    // Not resolved at build time, as the package is optional (and has no types when missing)
+    const packageName = 'serialport';
+    let SerialPort: any;
+    try {
+      ({ SerialPort } = await import(packageName));
+    } catch (e) {
+      throw new Error("The 'serialport' package is required for hardware access (npm install --no-save serialport)");
+    }
+
+    this.port = new SerialPort({
+      path: this.path,
+      baudRate: options.baudRate,
+      dataBits: options.dataBits ?? 8,
+      parity: options.parity ?? 'none',
+      stopBits: options.stopBits ?? 1,
+      autoOpen: false,
+    });
+    await this.call((callback) => this.port.open(callback));
+
+    this.port.on('data', (data: Uint8Array) => {
+      try {
+        this.controller?.enqueue(new Uint8Array(data));
+      } catch (e) {
+        // Stream closed
+      }
+    });
+    this.readable = new ReadableStream<Uint8Array>({
+      start: (controller) => {
+        this.controller = controller;
+      },
+      cancel: () => {
+        this.controller = null;
+      },
+    });
+    this.writable = new WritableStream<Uint8Array>({
+      write: (chunk) => this.call((callback) => this.port.write(chunk, callback)),
+    });
+  }
+
+  async close(): Promise<void> {
+    this.readable = null;
+    this.writable = null;
+    this.controller = null;
+    await this.call((callback) => this.port.close(callback));
+    this.port = null;
+  }
+
+  async setSignals(signals: SerialOutputSignals): Promise<void> {
+    if (signals.break !== undefined) {
+      await this.call((callback) => this.port.set({ brk: signals.break }, callback));
+    }
+  }
+
+  /**
+   * Call a callback-style serialport function
+   */
+  private call(fn: (callback: (err: Error | null) => void) => void): Promise<void> {
+    return new Promise((resolve, reject) => {
+      fn((err) => err ? reject(err) : resolve());
+    });
+  }
+}
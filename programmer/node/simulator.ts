@@ -0,0 +1,774 @@
+/**
+ * Simulated ATtiny3226 UPDI target
+ *
+ * Models the UPDI protocol engine (CS space, keys, SIB, pointer/repeat accesses, ACKs and
+ * response signature disable), the P:0 NVM controller (page buffer, page erase/write timing,
+ * EEPROM, user row and fuses) and CRCSCAN, behind a UpdiSerialPort. Characters are echoed
+ * and answered in real time according to the baud rate, the UPDI guard time and a
+ * configurable USB latency, so the UPDI stack can be timed end to end without hardware.
+ */
+
+import * as constants from "../serialupdi/constants.js";
+import { UpdiSerialPort } from "../serialupdi/physical.js";
+import { ATTINY3226_DEVICE } from "../devices.js";
+import { crc16Ccitt } from "../flash-image.js";
+
+// Peripheral addresses (ATtiny3226)
+const CRCSCAN_ADDRESS = 0x0120;
+const SYSCFG_ADDRESS = 0x0F00;
+const NVMCTRL_ADDRESS = 0x1000;
+const SIGROW_ADDRESS = 0x1100;
+
+// NVMCTRL registers and commands (see nvmp0.ts)
+const NVMCTRL_CTRLA = 0x00;
+const NVMCTRL_STATUS = 0x02;
+const NVMCTRL_DATA = 0x06;
+const NVMCTRL_ADDR = 0x08;
+const NVMCMD_NOP = 0x00;
+const NVMCMD_WRITE_PAGE = 0x01;
+const NVMCMD_ERASE_PAGE = 0x02;
+const NVMCMD_ERASE_WRITE_PAGE = 0x03;
+const NVMCMD_PAGE_BUFFER_CLR = 0x04;
+const NVMCMD_CHIP_ERASE = 0x05;
+const NVMCMD_ERASE_EEPROM = 0x06;
+const NVMCMD_WRITE_FUSE = 0x07;
+const NVMCTRL_STATUS_FBUSY_bm = 0x01;
+const NVMCTRL_STATUS_EEBUSY_bm = 0x02;
+const NVMCTRL_STATUS_WRERROR_bm = 0x04;
+
+// CRCSCAN registers
+const CRCSCAN_CTRLA = 0x00;
+const CRCSCAN_STATUS = 0x02;
+const CRCSCAN_ENABLE_bm = 0x01;
+const CRCSCAN_RESET_bm = 0x80;
+const CRCSCAN_BUSY_bm = 0x01;
+const CRCSCAN_OK_bm = 0x02;
+
+// UPDI CS register defaults
+const UPDI_STATUSA_VALUE = 0x30;    // UPDI revision 3
+const UPDI_CTRLA_GTVAL_gm = 0x07;
+const UPDI_ASI_CTRLA_DEFAULT = constants.UPDI_ASI_CTRLA_UPDICLKSEL_4MHZ;
+
+// Highest baud rate the UPDI can receive at 4 MHz UPDI clock (scales with the clock),
+// plus the usual UART clock tolerance
+const UPDI_MAX_BAUD_4MHZ = 225000;
+const UPDI_BAUD_TOLERANCE = 1.025;
+
+// Bits per UPDI character: start, 8 data, parity, 2 stop
+const UPDI_CHAR_BITS = 12;
+
+// System information block returned by the KEY SIB instruction
+const SIB = "tinyAVR P:0D:0-3M2 (01.59B14.0) ";
+
+export interface SimulatorOptions {
+  usbLatency?: number;              // Delay added to every transfer from the target to the host (ms)
+  flashPageWriteTime?: number;      // Flash page write time (ms)
+  flashPageEraseTime?: number;      // Flash page erase time (ms)
+  chipEraseTime?: number;           // Chip erase time (ms)
+  eepromWriteTime?: number;         // EEPROM (or user row) erase/write time (ms)
+  fuseWriteTime?: number;           // Fuse write time (ms)
+  crcScanTime?: number;             // CRCSCAN of the whole flash (ms)
+  locked?: boolean;                 // Device is locked (until chip erase)
+}
+
+const DEFAULT_SIMULATOR_OPTIONS: Required<SimulatorOptions> = {
+  usbLatency: 1,
+  flashPageWriteTime: 2,
+  flashPageEraseTime: 2,
+  chipEraseTime: 4,
+  eepromWriteTime: 4,
+  fuseWriteTime: 4,
+  crcScanTime: 2,
+  locked: false,
+};
+
+/**
+ * Parser states of the UPDI instruction decoder
+ */
+enum UpdiState {
+  Sync,           // waiting for SYNC
+  Opcode,         // waiting for the instruction
+  Operand,        // collecting address/data bytes for the current instruction
+  Disabled,       // UPDI disabled until the next break
+}
+
+/**
+ * UPDI protocol engine and memories of an ATtiny3226
+ */
+export class SimulatedTarget {
+  readonly flash: Uint8Array;
+  readonly eeprom: Uint8Array;
+  readonly userRow: Uint8Array;
+  readonly fuses: Uint8Array;
+
+  private options: Required<SimulatorOptions>;
+  private dataSpace = new Uint8Array(0x10000);   // everything not modelled specifically
+  private cs = new Uint8Array(16);
+
+  // Instruction decoder
+  private state = UpdiState.Sync;
+  private opcode = 0;
+  private operand: number[] = [];
+  private operandLength = 0;
+  private stsDataPhase = false;
+  private pointer = 0;
+  private repeat = 0;
+  private repeatLeft = 0;
+
+  // System state
+  private locked: boolean;
+  private inReset = false;
+  private nvmProg = false;
+  private urowProg = false;
+
+  // NVM controller
+  private pageBuffer = new Uint8Array(ATTINY3226_DEVICE.flash_page_size!).fill(0xff);
+  private pageBufferLoaded = new Uint8Array(ATTINY3226_DEVICE.flash_page_size!);
+  private pageBufferAddress = 0;
+  private nvmData = 0;
+  private nvmAddr = 0;
+  private nvmStatus = 0;
+  private flashBusyUntil = 0;
+  private eepromBusyUntil = 0;
+
+  // CRCSCAN
+  private crcScanBusyUntil = 0;
+  private crcScanResult = 0;
+
+  constructor(options: SimulatorOptions = {}) {
+    this.options = { ...DEFAULT_SIMULATOR_OPTIONS, ...options };
+    this.flash = new Uint8Array(ATTINY3226_DEVICE.flash_size!).fill(0xff);
+    this.eeprom = new Uint8Array(ATTINY3226_DEVICE.eeprom_size!).fill(0xff);
+    this.userRow = new Uint8Array(ATTINY3226_DEVICE.user_row_size!).fill(0xff);
+    this.fuses = new Uint8Array(ATTINY3226_DEVICE.fuses_size!).fill(0xff);
+    this.locked = this.options.locked;
+
+    const deviceId = ATTINY3226_DEVICE.device_id!;
+    this.dataSpace[SIGROW_ADDRESS] = (deviceId >> 16) & 0xff;
+    this.dataSpace[SIGROW_ADDRESS + 1] = (deviceId >> 8) & 0xff;
+    this.dataSpace[SIGROW_ADDRESS + 2] = deviceId & 0xff;
+    this.dataSpace[SYSCFG_ADDRESS + 1] = 0x01;  // REVID
+
+    this.resetCs();
+  }
+
+  get usbLatency(): number {
+    return this.options.usbLatency;
+  }
+
+  /**
+   * Highest baud rate the UPDI can currently receive, depending on the UPDI clock
+   */
+  get maxBaud(): number {
+    const clockMhz = [32, 16, 8, 4][this.cs[constants.UPDI_ASI_CTRLA] & 0x03];
+    return UPDI_MAX_BAUD_4MHZ * clockMhz / 4 * UPDI_BAUD_TOLERANCE;
+  }
+
+  /**
+   * Guard time inserted before the target starts transmitting, in bit times
+   */
+  get guardTime(): number {
+    const gtval = this.cs[constants.UPDI_CS_CTRLA] & UPDI_CTRLA_GTVAL_gm;
+    return gtval === 7 ? 2 : 128 >> gtval;
+  }
+
+  /**
+   * A break resets the instruction decoder (and re-enables a disabled UPDI)
+   */
+  break(): void {
+    if (this.state === UpdiState.Disabled) {
+      this.resetCs();
+    }
+    this.state = UpdiState.Sync;
+  }
+
+  /**
+   * Process one character received from the host
+   * @param byte character
+   * @param time time at which the character has been received completely (ms)
+   * @returns characters to send back to the host
+   */
+  receive(byte: number, time: number): number[] {
+    switch (this.state) {
+      case UpdiState.Disabled:
+        return [];
+
+      case UpdiState.Sync:
+        if (byte === constants.UPDI_PHY_SYNC) {
+          this.state = UpdiState.Opcode;
+        }
+        return [];
+
+      case UpdiState.Opcode:
+        return this.decode(byte, time);
+
+      case UpdiState.Operand:
+        this.operand.push(byte);
+        if (this.operand.length < this.operandLength) {
+          return [];
+        }
+        this.state = UpdiState.Sync;
+        return this.execute(time);
+    }
+  }
+
+  /**
+   * Decode an instruction, and execute it if it has no operands
+   */
+  private decode(opcode: number, time: number): number[] {
+    this.opcode = opcode;
+    this.operand = [];
+    this.state = UpdiState.Sync;
+
+    switch (opcode & 0xe0) {
+      case constants.UPDI_LDS:
+        return this.expectOperand(this.addressSize(opcode));
+      case constants.UPDI_STS:
+        return this.expectOperand(this.addressSize(opcode));
+      case constants.UPDI_LD:
+        if ((opcode & 0x0c) === constants.UPDI_PTR_ADDRESS) {
+          return this.pointerBytes(this.dataSize(opcode));
+        }
+        return this.loadRepeated(time);
+      case constants.UPDI_ST:
+        if ((opcode & 0x0c) === constants.UPDI_PTR_ADDRESS) {
+          return this.expectOperand(this.dataSize(opcode));
+        }
+        this.repeatLeft = this.repeat + 1;
+        this.repeat = 0;
+        return this.expectOperand(this.dataSize(opcode));
+      case constants.UPDI_LDCS:
+        return [this.readCs(opcode & 0x0f)];
+      case constants.UPDI_STCS:
+        return this.expectOperand(1);
+      case constants.UPDI_REPEAT:
+        return this.expectOperand((opcode & 0x03) + 1);
+      case constants.UPDI_KEY:
+        if (opcode & constants.UPDI_KEY_SIB) {
+          return Array.from(SIB.substring(0, 8 << (opcode & 0x03)), c => c.charCodeAt(0));
+        }
+        return this.expectOperand(8 << (opcode & 0x03));
+    }
+    return [];
+  }
+
+  /**
+   * Execute an instruction once all operand bytes have been received
+   */
+  private execute(time: number): number[] {
+    const value = this.operand.reduce((sum, byte, i) => sum + byte * (1 << (8 * i)), 0);
+    const rsd = (this.cs[constants.UPDI_CS_CTRLA] & (1 << constants.UPDI_CTRLA_RSD_BIT)) !== 0;
+    const ack = rsd ? [] : [constants.UPDI_PHY_ACK];
+
+    if (this.stsDataPhase) {
+      this.stsDataPhase = false;
+      for (let i = 0; i < this.operand.length; i++) {
+        this.writeMemory(this.pointer + i, this.operand[i], time);
+      }
+      return ack;
+    }
+
+    switch (this.opcode & 0xe0) {
+      case constants.UPDI_LDS: {
+        const size = this.dataSize(this.opcode);
+        const data: number[] = [];
+        for (let i = 0; i < size; i++) {
+          data.push(this.readMemory(value + i, time));
+        }
+        return data;
+      }
+
+      case constants.UPDI_STS:
+        // Address phase done, the data follows
+        this.stsDataPhase = true;
+        this.pointer = value;
+        this.expectOperand(this.dataSize(this.opcode));
+        return ack;
+
+      case constants.UPDI_ST:
+        if ((this.opcode & 0x0c) === constants.UPDI_PTR_ADDRESS) {
+          this.pointer = value;
+          return ack;
+        }
+        this.storeAtPointer(time);
+        if (--this.repeatLeft > 0) {
+          this.expectOperand(this.dataSize(this.opcode));
+        }
+        return ack;
+
+      case constants.UPDI_STCS:
+        this.writeCs(this.opcode & 0x0f, value);
+        return [];
+
+      case constants.UPDI_REPEAT:
+        this.repeat = value;
+        return [];
+
+      case constants.UPDI_KEY:
+        this.acceptKey(String.fromCharCode(...this.operand.reverse()));
+        return [];
+    }
+    return [];
+  }
+
+  private expectOperand(length: number): number[] {
+    this.operand = [];
+    this.operandLength = length;
+    this.state = UpdiState.Operand;
+    return [];
+  }
+
+  private addressSize(opcode: number): number {
+    return ((opcode >> 2) & 0x03) + 1;
+  }
+
+  private dataSize(opcode: number): number {
+    return (opcode & 0x03) + 1;
+  }
+
+  private pointerBytes(size: number): number[] {
+    return [this.pointer & 0xff, (this.pointer >> 8) & 0xff, (this.pointer >> 16) & 0xff].slice(0, size);
+  }
+
+  private loadRepeated(time: number): number[] {
+    const count = (this.repeat + 1) * this.dataSize(this.opcode);
+    this.repeat = 0;
+    const data: number[] = [];
+    for (let i = 0; i < count; i++) {
+      data.push(this.readMemory(this.pointer, time));
+      if ((this.opcode & 0x0c) === constants.UPDI_PTR_INC) {
+        this.pointer++;
+      }
+    }
+    return data;
+  }
+
+  private storeAtPointer(time: number): void {
+    for (const byte of this.operand) {
+      this.writeMemory(this.pointer, byte, time);
+      if ((this.opcode & 0x0c) === constants.UPDI_PTR_INC) {
+        this.pointer++;
+      }
+    }
+  }
+
+  private resetCs(): void {
+    this.cs.fill(0);
+    this.cs[constants.UPDI_CS_STATUSA] = UPDI_STATUSA_VALUE;
+    this.cs[constants.UPDI_ASI_CTRLA] = UPDI_ASI_CTRLA_DEFAULT;
+    this.repeat = 0;
+  }
+
+  private readCs(address: number): number {
+    if (address === constants.UPDI_ASI_SYS_STATUS) {
+      return (this.inReset ? 1 << constants.UPDI_ASI_SYS_STATUS_RSTSYS : 0) |
+        (this.nvmProg ? 1 << constants.UPDI_ASI_SYS_STATUS_NVMPROG : 0) |
+        (this.urowProg ? 1 << constants.UPDI_ASI_SYS_STATUS_UROWPROG : 0) |
+        (this.locked ? 1 << constants.UPDI_ASI_SYS_STATUS_LOCKSTATUS : 0);
+    }
+    return this.cs[address];
+  }
+
+  private writeCs(address: number, value: number): void {
+    switch (address) {
+      case constants.UPDI_CS_CTRLB:
+        this.cs[address] = value;
+        if (value & (1 << constants.UPDI_CTRLB_UPDIDIS_BIT)) {
+          // Disabling UPDI releases all keys and leaves programming mode
+          this.nvmProg = false;
+          this.urowProg = false;
+          this.cs[constants.UPDI_ASI_KEY_STATUS] = 0;
+          this.state = UpdiState.Disabled;
+        }
+        break;
+
+      case constants.UPDI_ASI_KEY_STATUS:
+        // Write one to clear
+        this.cs[address] &= ~value;
+        break;
+
+      case constants.UPDI_ASI_RESET_REQ:
+        if (value === constants.UPDI_RESET_REQ_VALUE) {
+          this.inReset = true;
+        } else if (this.inReset) {
+          this.inReset = false;
+          this.leaveReset();
+        }
+        break;
+
+      case constants.UPDI_ASI_SYS_CTRLA:
+        if ((value & (1 << constants.UPDI_ASI_SYS_CTRLA_UROW_FINAL)) && this.urowProg) {
+          this.programPageBuffer(true, true);
+          this.urowProg = false;
+        }
+        break;
+
+      default:
+        this.cs[address] = value;
+    }
+  }
+
+  /**
+   * Keys take effect when the device leaves reset
+   */
+  private leaveReset(): void {
+    const keyStatus = this.cs[constants.UPDI_ASI_KEY_STATUS];
+    if (keyStatus & (1 << constants.UPDI_ASI_KEY_STATUS_CHIPERASE)) {
+      this.flash.fill(0xff);
+      this.eeprom.fill(0xff);
+      this.locked = false;
+      this.cs[constants.UPDI_ASI_KEY_STATUS] &= ~(1 << constants.UPDI_ASI_KEY_STATUS_CHIPERASE);
+    }
+    if (keyStatus & (1 << constants.UPDI_ASI_KEY_STATUS_UROWWRITE)) {
+      this.urowProg = true;
+      this.clearPageBuffer();
+    }
+    this.nvmProg = (keyStatus & (1 << constants.UPDI_ASI_KEY_STATUS_NVMPROG)) !== 0 && !this.locked;
+  }
+
+  private acceptKey(key: string): void {
+    if (key === constants.UPDI_KEY_NVM) {
+      this.cs[constants.UPDI_ASI_KEY_STATUS] |= 1 << constants.UPDI_ASI_KEY_STATUS_NVMPROG;
+    } else if (key === constants.UPDI_KEY_CHIPERASE) {
+      this.cs[constants.UPDI_ASI_KEY_STATUS] |= 1 << constants.UPDI_ASI_KEY_STATUS_CHIPERASE;
+    } else if (key === constants.UPDI_KEY_UROW) {
+      this.cs[constants.UPDI_ASI_KEY_STATUS] |= 1 << constants.UPDI_ASI_KEY_STATUS_UROWWRITE;
+    }
+  }
+
+  private readMemory(address: number, time: number): number {
+    address &= 0xffff;
+    if (this.locked) {
+      return 0;
+    }
+
+    const flashAddress = ATTINY3226_DEVICE.flash_address!;
+    const eepromAddress = ATTINY3226_DEVICE.eeprom_address!;
+    const userRowAddress = ATTINY3226_DEVICE.user_row_address!;
+    const fusesAddress = ATTINY3226_DEVICE.fuses_address!;
+
+    if (address >= flashAddress) {
+      return this.flash[address - flashAddress];
+    }
+    if (address >= eepromAddress && address < eepromAddress + this.eeprom.length) {
+      return this.eeprom[address - eepromAddress];
+    }
+    if (address >= userRowAddress && address < userRowAddress + this.userRow.length) {
+      return this.userRow[address - userRowAddress];
+    }
+    if (address >= fusesAddress && address < fusesAddress + this.fuses.length) {
+      return this.fuses[address - fusesAddress];
+    }
+    if (address === NVMCTRL_ADDRESS + NVMCTRL_STATUS) {
+      return this.nvmStatus |
+        (time < this.flashBusyUntil ? NVMCTRL_STATUS_FBUSY_bm : 0) |
+        (time < this.eepromBusyUntil ? NVMCTRL_STATUS_EEBUSY_bm : 0);
+    }
+    if (address === CRCSCAN_ADDRESS + CRCSCAN_STATUS) {
+      if (time < this.crcScanBusyUntil) {
+        return CRCSCAN_BUSY_bm;
+      }
+      return this.crcScanBusyUntil > 0 && this.crcScanResult === 0 ? CRCSCAN_OK_bm : 0;
+    }
+    return this.dataSpace[address];
+  }
+
+  private writeMemory(address: number, value: number, time: number): void {
+    address &= 0xffff;
+    if (this.locked && !this.urowProg) {
+      return;
+    }
+
+    const flashAddress = ATTINY3226_DEVICE.flash_address!;
+    const eepromAddress = ATTINY3226_DEVICE.eeprom_address!;
+    const userRowAddress = ATTINY3226_DEVICE.user_row_address!;
+
+    if (this.urowProg) {
+      // Only the user row is accessible in user row programming mode
+      if (address >= userRowAddress && address < userRowAddress + this.userRow.length) {
+        this.loadPageBuffer(address, value);
+      }
+      return;
+    }
+
+    if (address >= flashAddress ||
+        (address >= eepromAddress && address < eepromAddress + this.eeprom.length) ||
+        (address >= userRowAddress && address < userRowAddress + this.userRow.length)) {
+      if (this.nvmProg) {
+        this.loadPageBuffer(address, value);
+      }
+      return;
+    }
+
+    switch (address) {
+      case NVMCTRL_ADDRESS + NVMCTRL_CTRLA:
+        if (this.nvmProg) {
+          this.executeNvmCommand(value, time);
+        }
+        return;
+      case NVMCTRL_ADDRESS + NVMCTRL_STATUS:
+        return;
+      case NVMCTRL_ADDRESS + NVMCTRL_DATA:
+        this.nvmData = (this.nvmData & 0xff00) | value;
+        return;
+      case NVMCTRL_ADDRESS + NVMCTRL_DATA + 1:
+        this.nvmData = (this.nvmData & 0x00ff) | (value << 8);
+        return;
+      case NVMCTRL_ADDRESS + NVMCTRL_ADDR:
+        this.nvmAddr = (this.nvmAddr & 0xff00) | value;
+        return;
+      case NVMCTRL_ADDRESS + NVMCTRL_ADDR + 1:
+        this.nvmAddr = (this.nvmAddr & 0x00ff) | (value << 8);
+        return;
+      case CRCSCAN_ADDRESS + CRCSCAN_CTRLA:
+        if (value & CRCSCAN_RESET_bm) {
+          this.crcScanBusyUntil = 0;
+        } else if (value & CRCSCAN_ENABLE_bm) {
+          this.crcScanResult = crc16Ccitt(this.flash);
+          this.crcScanBusyUntil = time + this.options.crcScanTime;
+        }
+        return;
+    }
+    this.dataSpace[address] = value;
+  }
+
+  private loadPageBuffer(address: number, value: number): void {
+    const offset = address & (this.pageBuffer.length - 1);
+    this.pageBuffer[offset] &= value;
+    this.pageBufferLoaded[offset] = 1;
+    this.pageBufferAddress = address;
+  }
+
+  private clearPageBuffer(): void {
+    this.pageBuffer.fill(0xff);
+    this.pageBufferLoaded.fill(0);
+  }
+
+  /**
+   * Find the memory and page the page buffer belongs to
+   */
+  private bufferTarget(): { memory: Uint8Array; offset: number; pageSize: number; isFlash: boolean } | null {
+    const address = this.pageBufferAddress;
+    const flashAddress = ATTINY3226_DEVICE.flash_address!;
+    const eepromAddress = ATTINY3226_DEVICE.eeprom_address!;
+    const userRowAddress = ATTINY3226_DEVICE.user_row_address!;
+
+    if (address >= flashAddress) {
+      const pageSize = ATTINY3226_DEVICE.flash_page_size!;
+      return { memory: this.flash, offset: (address - flashAddress) & ~(pageSize - 1), pageSize, isFlash: true };
+    }
+    if (address >= eepromAddress && address < eepromAddress + this.eeprom.length) {
+      const pageSize = ATTINY3226_DEVICE.eeprom_page_size!;
+      return { memory: this.eeprom, offset: (address - eepromAddress) & ~(pageSize - 1), pageSize, isFlash: false };
+    }
+    if (address >= userRowAddress && address < userRowAddress + this.userRow.length) {
+      return { memory: this.userRow, offset: 0, pageSize: this.userRow.length, isFlash: false };
+    }
+    return null;
+  }
+
+  /**
+   * Erase and/or write the page addressed by the page buffer. Flash pages are erased as a
+   * whole; EEPROM and user row are erased byte by byte, only where the buffer was loaded.
+   */
+  private programPageBuffer(erase: boolean, write: boolean): boolean {
+    const target = this.bufferTarget();
+    if (!target) {
+      return false;
+    }
+    const { memory, offset, pageSize, isFlash } = target;
+    for (let i = 0; i < pageSize; i++) {
+      const bufferIndex = (offset + i) & (this.pageBuffer.length - 1);
+      const loaded = this.pageBufferLoaded[bufferIndex] !== 0;
+      if (erase && (isFlash || loaded)) {
+        memory[offset + i] = 0xff;
+      }
+      if (write && loaded) {
+        memory[offset + i] &= this.pageBuffer[bufferIndex];
+      }
+    }
+    this.clearPageBuffer();
+    return isFlash;
+  }
+
+  private executeNvmCommand(command: number, time: number): void {
+    if (time < this.flashBusyUntil || time < this.eepromBusyUntil) {
+      this.nvmStatus |= NVMCTRL_STATUS_WRERROR_bm;
+      return;
+    }
+    this.nvmStatus = 0;
+
+    const options = this.options;
+    switch (command) {
+      case NVMCMD_NOP:
+        break;
+      case NVMCMD_WRITE_PAGE:
+        this.setBusy(this.programPageBuffer(false, true), time, options.flashPageWriteTime, options.eepromWriteTime);
+        break;
+      case NVMCMD_ERASE_PAGE:
+        this.setBusy(this.programPageBuffer(true, false), time, options.flashPageEraseTime, options.eepromWriteTime);
+        break;
+      case NVMCMD_ERASE_WRITE_PAGE:
+        this.setBusy(this.programPageBuffer(true, true), time,
+          options.flashPageEraseTime + options.flashPageWriteTime, options.eepromWriteTime);
+        break;
+      case NVMCMD_PAGE_BUFFER_CLR:
+        this.clearPageBuffer();
+        break;
+      case NVMCMD_CHIP_ERASE:
+        this.flash.fill(0xff);
+        this.eeprom.fill(0xff);
+        this.flashBusyUntil = time + options.chipEraseTime;
+        break;
+      case NVMCMD_ERASE_EEPROM:
+        this.eeprom.fill(0xff);
+        this.eepromBusyUntil = time + options.eepromWriteTime;
+        break;
+      case NVMCMD_WRITE_FUSE: {
+        const index = this.nvmAddr - ATTINY3226_DEVICE.fuses_address!;
+        if (index >= 0 && index < this.fuses.length) {
+          this.fuses[index] = this.nvmData & 0xff;
+        }
+        this.eepromBusyUntil = time + options.fuseWriteTime;
+        break;
+      }
+      default:
+        this.nvmStatus |= NVMCTRL_STATUS_WRERROR_bm;
+    }
+  }
+
+  private setBusy(isFlash: boolean, time: number, flashTime: number, eepromTime: number): void {
+    if (isFlash) {
+      this.flashBusyUntil = time + flashTime;
+    } else {
+      this.eepromBusyUntil = time + eepromTime;
+    }
+  }
+}
+
+/**
+ * Serial port connected to a simulated target, with a USB-to-serial adapter wired for UPDI
+ * (TX and RX joined, so every character is echoed).
+ */
+export class SimulatedSerialPort implements UpdiSerialPort {
+  readonly target: SimulatedTarget;
+  readable: ReadableStream<Uint8Array> | null = null;
+  writable: WritableStream<Uint8Array> | null = null;
+
+  private baud = 0;
+  private controller: ReadableStreamDefaultController<Uint8Array> | null = null;
+  private lineFree = 0;     // time at which the line is idle again (ms)
+  private deliveries: { time: number; data: Uint8Array }[] = [];
+  private deliveryTimer: ReturnType<typeof setTimeout> | null = null;
+
+  constructor(target?: SimulatedTarget) {
+    this.target = target ?? new SimulatedTarget();
+  }
+
+  async open(options: SerialOptions): Promise<void> {
+    if (this.writable) {
+      throw new Error('Port is already open');
+    }
+    this.baud = options.baudRate;
+    this.readable = this.createReadable();
+    this.writable = new WritableStream<Uint8Array>({
+      write: (chunk) => this.transmit(chunk),
+    });
+  }
+
+  async close(): Promise<void> {
+    if (!this.writable) {
+      throw new Error('Port is not open');
+    }
+    if (this.readable?.locked || this.writable.locked) {
+      throw new Error('Cannot close a port with locked streams');
+    }
+    this.cancelDeliveries();
+    this.readable = null;
+    this.writable = null;
+    this.controller = null;
+  }
+
+  async setSignals(signals: SerialOutputSignals): Promise<void> {
+    if (signals.break) {
+      // Like Web Serial, report the break as an error and continue with a new stream
+      this.cancelDeliveries();
+      this.target.break();
+      const controller = this.controller;
+      this.readable = this.createReadable();
+      controller?.error(new Error('Break received'));
+    }
+  }
+
+  private createReadable(): ReadableStream<Uint8Array> {
+    return new ReadableStream<Uint8Array>({
+      start: (controller) => {
+        this.controller = controller;
+      },
+    });
+  }
+
+  /**
+   * Put characters on the line: each one is echoed and processed by the target as soon as
+   * it has been received completely, and responses follow after the guard time.
+   */
+  private transmit(data: Uint8Array): void {
+    const charTime = UPDI_CHAR_BITS * 1000 / this.baud;
+    const synced = this.baud <= this.target.maxBaud;
+    let time = Math.max(performance.now(), this.lineFree);
+    let echoStart = 0;
+
+    for (let i = 0; i < data.length; i++) {
+      time += charTime;
+      // A target that cannot keep up with the baud rate receives garbage and stays silent
+      const response = synced ? this.target.receive(data[i], time) : [];
+      if (response.length > 0) {
+        this.deliver(data.slice(echoStart, i + 1), time);
+        echoStart = i + 1;
+        time += this.target.guardTime * 1000 / this.baud + response.length * charTime;
+        this.deliver(new Uint8Array(response), time);
+      }
+    }
+    if (echoStart < data.length) {
+      this.deliver(data.slice(echoStart), time);
+    }
+    this.lineFree = time;
+  }
+
+  /**
+   * Queue data for delivery to the host at the given time (plus USB latency)
+   */
+  private deliver(data: Uint8Array, time: number): void {
+    this.deliveries.push({ time: time + this.target.usbLatency, data });
+    if (this.deliveries.length === 1) {
+      this.scheduleDelivery();
+    }
+  }
+
+  private scheduleDelivery(): void {
+    const delay = Math.max(0, this.deliveries[0].time - performance.now());
+    this.deliveryTimer = setTimeout(() => {
+      this.deliveryTimer = null;
+      const now = performance.now();
+      while (this.deliveries.length > 0 && this.deliveries[0].time <= now) {
+        const { data } = this.deliveries.shift()!;
+        try {
+          this.controller?.enqueue(data);
+        } catch (e) {
+          // Stream closed
+        }
+      }
+      if (this.deliveries.length > 0) {
+        this.scheduleDelivery();
+      }
+    }, delay);
+  }
+
+  private cancelDeliveries(): void {
+    if (this.deliveryTimer) {
+      clearTimeout(this.deliveryTimer);
+      this.deliveryTimer = null;
+    }
+    this.deliveries = [];
+  }
+}
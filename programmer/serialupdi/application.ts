@@ -4,12 +4,18 @@
 
 import * as constants from "./constants.js";
 import { UpdiDatalink16bit, UpdiDatalink24bit } from "./link.js";
-import { UpdiPhysical } from "./physical.js";
+import { UpdiPhysical, UpdiSerialPort } from "./physical.js";
 import { UpdiReadWrite } from "./readwrite.js";
-import { NvmUpdi } from "./nvm.js";
+import { NvmRange, NvmUpdi } from "./nvm.js";
 import { NvmUpdiP0 } from "./nvmp0.js";
 import { Timeout } from "./timeout.js";
 
+// Baud rates to try when negotiating a faster link, in ascending order
+const NEGOTIATION_BAUD_RATES = [230400, 460800, 921600];
+
+// Number of STATUSA reads to validate a baud rate
+const NEGOTIATION_CHECK_READS = 4;
+
 interface SibInfo {
   family: string;
   NVM: string;
@@ -58,9 +64,12 @@ export function decodeSib(sib: string): SibInfo | null {
  */
 export class UpdiApplication {
   private phy: UpdiPhysical;
+  private datalink: UpdiDatalink16bit | UpdiDatalink24bit | null = null;
   private readwrite: UpdiReadWrite | null = null;
+  private burstWrites: boolean = true;
   private nvm: NvmUpdi | null = null;
   private device: any;
+  private initialBaud: number;
 
   /**
    * Create an UPDI application instance
@@ -70,12 +79,13 @@ export class UpdiApplication {
    * @param timeout read timeout for serial port in seconds
    */
   constructor(
-    serialport: SerialPort,
+    serialport: UpdiSerialPort,
     baud: number,
     device?: any,
     timeout?: number
   ) {
     this.device = device;
+    this.initialBaud = baud;
 
     // Build the UPDI stack:
     // Create a physical
@@ -93,14 +103,83 @@ export class UpdiApplication {
 
     // Init (active) the datalink - must be called async later
     await datalink.initDatalink();
+    this.datalink = datalink;
 
     // Create a read write access layer using this data link
-    this.readwrite = new UpdiReadWrite(datalink);
+    this.readwrite = new UpdiReadWrite(datalink, this.burstWrites);
 
     // Create an NVM driver
     this.nvm = new NvmUpdi(this.readwrite, this.device);
   }
 
+  /**
+   * Selects how blocks of data (flash pages, EEPROM, user row) are written: as a single
+   * ACK-less burst (default), or byte by byte with ACK checking (slower, for debugging).
+   * @param enabled True to use burst writes
+   */
+  setBurstWrites(enabled: boolean): void {
+    this.burstWrites = enabled;
+    if (this.readwrite) {
+      this.readwrite.burstWrites = enabled;
+    }
+  }
+
+  /**
+   * Switches the UPDI clock to 16 MHz (from the default of 4 MHz, which limits the baud rate
+   * to about 225 kbps) and tries progressively higher baud rates, validating each one by
+   * reading STATUSA. Falls back to the last working rate as soon as errors appear.
+   * Must be called after init().
+   * @param baudRates baud rates to try, in ascending order
+   * @returns baud rate in use afterwards
+   */
+  async negotiateBaud(baudRates: number[] = NEGOTIATION_BAUD_RATES): Promise<number> {
+    await this.readwrite!.writeCs(
+      constants.UPDI_ASI_CTRLA,
+      constants.UPDI_ASI_CTRLA_UPDICLKSEL_16MHZ
+    );
+
+    for (const baud of baudRates) {
+      const previousBaud = this.phy.getBaud();
+      if (baud <= previousBaud) {
+        continue;
+      }
+
+      try {
+        await this.phy.setBaud(baud);
+        if (await this.checkLink()) {
+          continue;
+        }
+      } catch {
+        // Treat like a failed check
+      }
+
+      // Go back to the last working baud rate, and resynchronize
+      await this.phy.setBaud(previousBaud);
+      await this.phy.sendDoubleBreak();
+      await this.datalink!.initDatalink();
+      break;
+    }
+
+    return this.phy.getBaud();
+  }
+
+  /**
+   * Checks that the link works by reading STATUSA a few times
+   * @returns True if all reads succeeded
+   */
+  private async checkLink(): Promise<boolean> {
+    try {
+      for (let i = 0; i < NEGOTIATION_CHECK_READS; i++) {
+        if (await this.readwrite!.readCs(constants.UPDI_CS_STATUSA) === 0) {
+          return false;
+        }
+      }
+    } catch {
+      return false;
+    }
+    return true;
+  }
+
   /**
    * Reads out device information from various sources
    * @returns Device information decoded from SIB
@@ -127,7 +206,8 @@ export class UpdiApplication {
       const datalink = new UpdiDatalink16bit();
       datalink.setPhysical(this.phy);
       await datalink.initDatalink();
-      this.readwrite = new UpdiReadWrite(datalink);
+      this.datalink = datalink;
+      this.readwrite = new UpdiReadWrite(datalink, this.burstWrites);
       this.nvm = new NvmUpdiP0(this.readwrite!, this.device);
     } else {
       throw new Error("Unsupported NVM revision");
@@ -396,6 +476,21 @@ export class UpdiApplication {
     );
   }
 
+  /**
+   * Leaves programming mode so that the firmware runs, and reopens the UPDI session without
+   * another reset, so that memory can be read while the CPU is running (e.g. telemetry in RAM).
+   * Disabling the UPDI resets its clock, so the session continues at the initial baud rate;
+   * call negotiateBaud() again if needed. enterProgmode() stops the firmware again.
+   */
+  async runTarget(): Promise<void> {
+    await this.leaveProgmode();
+    if (this.phy.getBaud() !== this.initialBaud) {
+      await this.phy.setBaud(this.initialBaud);
+    }
+    await this.phy.sendDoubleBreak();
+    await this.datalink!.initDatalink();
+  }
+
   /**
    * Applies or releases an UPDI reset condition
    * @param applyReset True to apply, False to release
@@ -423,6 +518,18 @@ export class UpdiApplication {
     await this.nvm.writeFlash(address, data);
   }
 
+  /**
+   * Erase a flash page and write it with new data
+   * @param address address of the page
+   * @param data data to write (one page)
+   */
+  async eraseWriteFlashPage(address: number, data: Uint8Array): Promise<void> {
+    if (!this.nvm) {
+      throw new Error('NVM driver not initialized');
+    }
+    await this.nvm.eraseWriteFlashPage(address, data);
+  }
+
   /**
    * Write data to EEPROM
    * @param address address to write to
@@ -435,6 +542,17 @@ export class UpdiApplication {
     await this.nvm.writeEeprom(address, data);
   }
 
+  /**
+   * Write separate ranges of one EEPROM page, leaving the other bytes of the page untouched
+   * @param ranges ranges to write, all within the same page
+   */
+  async writeEepromRanges(ranges: NvmRange[]): Promise<void> {
+    if (!this.nvm) {
+      throw new Error('NVM driver not initialized');
+    }
+    await this.nvm.writeEepromRanges(ranges);
+  }
+
   /**
    * Write data to user row
    * @param address address to write to
@@ -469,4 +587,21 @@ export class UpdiApplication {
     }
     await this.nvm.eraseFlashPage(address);
   }
+
+  /**
+   * Erase the whole flash and EEPROM
+   */
+  async chipErase(): Promise<void> {
+    if (!this.nvm) {
+      throw new Error('NVM driver not initialized');
+    }
+    await this.nvm.chipErase();
+  }
+
+  /**
+   * Stop reading from the serial port and close it
+   */
+  async destroy(): Promise<void> {
+    await this.phy.destroy();
+  }
 }
@@ -55,6 +55,10 @@ export const UPDI_ASI_SYS_CTRLA = 0x0a;
 export const UPDI_ASI_SYS_STATUS = 0x0b;
 export const UPDI_ASI_CRC_STATUS = 0x0c;
 
+export const UPDI_ASI_CTRLA_UPDICLKSEL_16MHZ = 0x01;
+export const UPDI_ASI_CTRLA_UPDICLKSEL_8MHZ = 0x02;
+export const UPDI_ASI_CTRLA_UPDICLKSEL_4MHZ = 0x03;
+
 export const UPDI_CTRLA_IBDLY_BIT = 7;
 export const UPDI_CTRLA_RSD_BIT = 3;
 
@@ -205,6 +205,46 @@ export class UpdiDatalink {
     }
   }
 
+  /**
+   * Store a block of data to an address as a single burst: disable response signatures (ACKs),
+   * set the pointer, set the repeat counter, store the data with pointer post-increment and
+   * re-enable ACKs, all in one serial write. Only the echo is read back, so errors are not
+   * detected here and must be caught by verification.
+   * @param address address to write to
+   * @param data data to store
+   * @param wordAccess True to use 16-bit accesses (data length must be even)
+   */
+  async stBurst(address: number, data: Uint8Array, wordAccess: boolean): Promise<void> {
+    if (!this.updiPhy) throw new Error("Physical layer not initialized");
+    const count = wordAccess ? data.length >> 1 : data.length;
+    if (count < 1 || count > constants.UPDI_MAX_REPEAT_SIZE) {
+      throw new Error("Invalid burst size!");
+    }
+
+    const header = [
+      constants.UPDI_PHY_SYNC,
+      constants.UPDI_STCS | constants.UPDI_CS_CTRLA,
+      (1 << constants.UPDI_CTRLA_IBDLY_BIT) | (1 << constants.UPDI_CTRLA_RSD_BIT),
+      ...this.stPtrFrame(address),
+      constants.UPDI_PHY_SYNC,
+      constants.UPDI_REPEAT | constants.UPDI_REPEAT_BYTE,
+      (count - 1) & 0xff,
+      constants.UPDI_PHY_SYNC,
+      constants.UPDI_ST | constants.UPDI_PTR_INC | (wordAccess ? constants.UPDI_DATA_16 : constants.UPDI_DATA_8),
+    ];
+    const trailer = [
+      constants.UPDI_PHY_SYNC,
+      constants.UPDI_STCS | constants.UPDI_CS_CTRLA,
+      1 << constants.UPDI_CTRLA_IBDLY_BIT,
+    ];
+
+    const frame = new Uint8Array(header.length + data.length + trailer.length);
+    frame.set(header, 0);
+    frame.set(data, header.length);
+    frame.set(trailer, header.length + data.length);
+    await this.updiPhy.send(frame);
+  }
+
   /**
    * Store a value to the repeat counter
    * @param repeats number of repeats requested
@@ -294,6 +334,15 @@ export class UpdiDatalink {
     throw new Error("stPtr() must be implemented in subclass");
   }
 
+  /**
+   * Build the frame for setting the pointer location (without waiting for the ACK)
+   * @param address address to write
+   * @return frame bytes
+   */
+  protected stPtrFrame(address: number): number[] {
+    throw new Error("stPtrFrame() must be implemented in subclass");
+  }
+
   /**
    * Performs data phase of transaction:
    * * receive ACK
@@ -391,17 +440,21 @@ export class UpdiDatalink16bit extends UpdiDatalink {
    */
   async stPtr(address: number): Promise<void> {
     if (!this.updiPhy) throw new Error("Physical layer not initialized");
-    await this.updiPhy.send(new Uint8Array([
-      constants.UPDI_PHY_SYNC,
-      constants.UPDI_ST | constants.UPDI_PTR_ADDRESS | constants.UPDI_DATA_16,
-      address & 0xff,
-      (address >> 8) & 0xff,
-    ]));
+    await this.updiPhy.send(new Uint8Array(this.stPtrFrame(address)));
     const response = await this.updiPhy.receive(1);
     if (response.length !== 1 || response[0] !== constants.UPDI_PHY_ACK) {
       throw new Error("Error with st_ptr");
     }
   }
+
+  protected stPtrFrame(address: number): number[] {
+    return [
+      constants.UPDI_PHY_SYNC,
+      constants.UPDI_ST | constants.UPDI_PTR_ADDRESS | constants.UPDI_DATA_16,
+      address & 0xff,
+      (address >> 8) & 0xff,
+    ];
+  }
 }
 
 /**
@@ -484,16 +537,20 @@ export class UpdiDatalink24bit extends UpdiDatalink {
    */
   async stPtr(address: number): Promise<void> {
     if (!this.updiPhy) throw new Error("Physical layer not initialized");
-    await this.updiPhy.send(new Uint8Array([
+    await this.updiPhy.send(new Uint8Array(this.stPtrFrame(address)));
+    const response = await this.updiPhy.receive(1);
+    if (response.length !== 1 || response[0] !== constants.UPDI_PHY_ACK) {
+      throw new Error("Error with st_ptr");
+    }
+  }
+
+  protected stPtrFrame(address: number): number[] {
+    return [
       constants.UPDI_PHY_SYNC,
       constants.UPDI_ST | constants.UPDI_PTR_ADDRESS | constants.UPDI_DATA_24,
       address & 0xff,
       (address >> 8) & 0xff,
       (address >> 16) & 0xff,
-    ]));
-    const response = await this.updiPhy.receive(1);
-    if (response.length !== 1 || response[0] !== constants.UPDI_PHY_ACK) {
-      throw new Error("Error with st_ptr");
-    }
+    ];
   }
 }
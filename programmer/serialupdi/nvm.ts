@@ -4,6 +4,14 @@
 
 import { UpdiReadWrite } from "./readwrite.js";
 
+/**
+ * A contiguous range of bytes to write
+ */
+export interface NvmRange {
+  address: number;
+  data: Uint8Array;
+}
+
 /**
  * Base class for NVM
  */
@@ -31,6 +39,15 @@ export class NvmUpdi {
     throw new Error("Not implemented");
   }
 
+  /**
+   * Erases a single flash page and writes it with new data in one operation
+   * @param address Start address of page
+   * @param data data to write (one page)
+   */
+  async eraseWriteFlashPage(address: number, data: Uint8Array): Promise<void> {
+    throw new Error("Not implemented");
+  }
+
   /**
    * Erase EEPROM memory only
    */
@@ -74,6 +91,15 @@ export class NvmUpdi {
     throw new Error("Not implemented");
   }
 
+  /**
+   * Write separate ranges of one EEPROM page in a single page write, leaving the other
+   * bytes of the page untouched
+   * @param ranges ranges to write, all within the same page
+   */
+  async writeEepromRanges(ranges: NvmRange[]): Promise<void> {
+    throw new Error("Not implemented");
+  }
+
   /**
    * Writes one fuse value
    * @param address address to write to
@@ -3,7 +3,7 @@
  * Present on tiny0, 1, 2 and mega0 (e.g: tiny817 -> mega4809)
  */
 
-import { NvmUpdi } from "./nvm.js";
+import { NvmRange, NvmUpdi } from "./nvm.js";
 import { UpdiReadWrite } from "./readwrite.js";
 import { Timeout } from "./timeout.js";
 
@@ -114,6 +114,10 @@ export class NvmUpdiP0 extends NvmUpdi {
     await this.writeNvm(address, data, true);
   }
 
+  async eraseWriteFlashPage(address: number, data: Uint8Array): Promise<void> {
+    await this.writeNvm(address, data, true, NvmUpdiP0.NVMCMD_ERASE_WRITE_PAGE);
+  }
+
   async writeUserRow(address: number, data: Uint8Array): Promise<void> {
     // On this NVM variant user row is implemented as EEPROM
     await this.writeEeprom(address, data);
@@ -123,6 +127,35 @@ export class NvmUpdiP0 extends NvmUpdi {
     await this.writeNvm(address, data, false, NvmUpdiP0.NVMCMD_ERASE_WRITE_PAGE);
   }
 
+  async writeEepromRanges(ranges: NvmRange[]): Promise<void> {
+    if (!await this.waitNvmReady()) {
+      throw new Error(
+        "Timeout waiting for NVM controller to be ready before page buffer clear"
+      );
+    }
+
+    await this.executeNvmCommand(NvmUpdiP0.NVMCMD_PAGE_BUFFER_CLR);
+
+    if (!await this.waitNvmReady()) {
+      throw new Error(
+        "Timeout waiting for NVM controller to be ready after page buffer clear"
+      );
+    }
+
+    // Only the EEPROM bytes loaded into the page buffer are erased and written
+    for (const range of ranges) {
+      await this.readwrite.writeData(range.address, range.data);
+    }
+
+    await this.executeNvmCommand(NvmUpdiP0.NVMCMD_ERASE_WRITE_PAGE);
+
+    if (!await this.waitNvmReady()) {
+      throw new Error(
+        "Timeout waiting for NVM controller to be ready after page write"
+      );
+    }
+  }
+
   async writeFuse(address: number, data: Uint8Array): Promise<void> {
     if (!await this.waitNvmReady()) {
       throw new Error(
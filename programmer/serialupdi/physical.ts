@@ -6,17 +6,48 @@ import * as constants from "./constants.js";
 
 const DEFAULT_SERIALUPDI_BAUD = 115200;
 
+// Initial size of the receive ring buffer (grows if needed; must be a power of two)
+const RX_BUFFER_SIZE = 4096;
+
+// Time to wait for the echo of a break before flushing the input (ms)
+const BREAK_FLUSH_TIMEOUT = 50;
+
+/**
+ * The part of the Web Serial SerialPort interface that the UPDI stack uses. Any other
+ * transport (e.g. a Node.js serial port or a simulated target) can be plugged in by
+ * implementing it.
+ */
+export interface UpdiSerialPort {
+  readonly readable: ReadableStream<Uint8Array> | null;
+  readonly writable: WritableStream<Uint8Array> | null;
+  open(options: SerialOptions): Promise<void>;
+  close(): Promise<void>;
+  setSignals(signals: SerialOutputSignals): Promise<void>;
+}
+
 /**
  * PDI physical driver using a given serial port at a given baud
+ *
+ * A single long-lived reader pumps all incoming data into a ring buffer, from which echoes
+ * are discarded and responses are taken synchronously. Only waiting for data that has not
+ * arrived yet involves a promise, with a single deadline timer.
  */
 export class UpdiPhysical {
-  private ibdly: number = 0.0001;
-  private port: SerialPort;
+  private port: UpdiSerialPort;
   private baud: number;
   private timeout: number;
-  private ser: any = null;
   private initPromise: Promise<void>;
 
+  private writer: WritableStreamDefaultWriter<Uint8Array> | null = null;
+  private reader: ReadableStreamDefaultReader<Uint8Array> | null = null;
+  private pumpPromise: Promise<void> | null = null;
+  private closing = false;
+
+  private rxBuffer = new Uint8Array(RX_BUFFER_SIZE);
+  private rxHead = 0;   // write position (total bytes received, wraps via mask)
+  private rxTail = 0;   // read position
+  private rxWaiter: { count: number; resolve: () => void } | null = null;
+
   /**
    * Serial port physical interface for UPDI
    * @param port Serial port name to connect to
@@ -24,7 +55,7 @@ export class UpdiPhysical {
    * @param timeout timeout value for serial reading
    */
   constructor(
-    port: SerialPort,
+    port: UpdiSerialPort,
     baud?: number,
     timeout?: number
   ) {
@@ -66,70 +97,193 @@ export class UpdiPhysical {
     } catch (e) {
       throw e;
     }
+
+    if (!this.port.writable) {
+      throw new Error('Serial port writable stream is not available');
+    }
+    this.writer = this.port.writable.getWriter();
+    this.closing = false;
+    this.discardInput();
+    this.pumpPromise = this.pump();
   }
 
   /**
-     * Read data with timeout
-     */
-  private async readWithTimeout(
-    bytesToRead: number
-  ): Promise<Uint8Array> {
-    const tempReader = this.port.readable!.getReader({ mode: 'byob' }) as ReadableStreamBYOBReader;
-    try {
-      const result = new Uint8Array(bytesToRead);
-      let bytesRead = 0;
-
-      while (bytesRead < bytesToRead) {
-        const buffer = new ArrayBuffer(bytesToRead - bytesRead);
-        const view = new Uint8Array(buffer);
-
-        const readResult = await Promise.race([
-          tempReader.read(view),
-          new Promise<never>((_, reject) =>
-            setTimeout(() => reject(new Error('Read timeout')), this.timeout)
-          )
-        ]);
-
-        if (readResult.done) {
-          // Stream has been closed
-          break;
-        }
+   * Release the streams and close the port
+   */
+  private async closeSerial(): Promise<void> {
+    this.closing = true;
+    if (this.reader) {
+      try {
+        await this.reader.cancel();
+      } catch (e) {
+        // Stream might already be closed
+      }
+    }
+    if (this.pumpPromise) {
+      await this.pumpPromise;
+      this.pumpPromise = null;
+    }
+    if (this.writer) {
+      this.writer.releaseLock();
+      this.writer = null;
+    }
+    await this.port.close();
+  }
 
-        if (readResult.value && readResult.value.byteLength > 0) {
-          result.set(readResult.value, bytesRead);
-          bytesRead += readResult.value.byteLength;
+  /**
+   * Read everything the port delivers into the ring buffer until the port is closed.
+   * Non-fatal errors (e.g. the framing error caused by a break) end the current readable
+   * stream; the port then provides a new one, which we continue with.
+   */
+  private async pump(): Promise<void> {
+    while (!this.closing && this.port.readable) {
+      this.reader = this.port.readable.getReader();
+      try {
+        while (true) {
+          const { value, done } = await this.reader.read();
+          if (done) {
+            break;
+          }
+          if (value) {
+            this.appendInput(value);
+          }
         }
+      } catch (e) {
+        // Non-fatal read error - continue with the next readable stream
+      } finally {
+        this.reader.releaseLock();
+        this.reader = null;
+      }
+    }
+  }
+
+  /**
+   * Append received data to the ring buffer and wake up a waiting receiver if enough data is there
+   */
+  private appendInput(data: Uint8Array): void {
+    const used = this.rxHead - this.rxTail;
+    if (used + data.length > this.rxBuffer.length) {
+      // Grow (rarely happens; responses are at most a few hundred bytes)
+      let size = this.rxBuffer.length;
+      while (used + data.length > size) {
+        size <<= 1;
       }
+      const grown = new Uint8Array(size);
+      this.copyInput(grown, used);
+      this.rxBuffer = grown;
+      this.rxTail = 0;
+      this.rxHead = used;
+    }
+
+    const mask = this.rxBuffer.length - 1;
+    const start = this.rxHead & mask;
+    const first = Math.min(data.length, this.rxBuffer.length - start);
+    this.rxBuffer.set(data.subarray(0, first), start);
+    if (first < data.length) {
+      this.rxBuffer.set(data.subarray(first), 0);
+    }
+    this.rxHead += data.length;
 
-      return result.subarray(0, bytesRead);
+    if (this.rxWaiter && this.rxHead - this.rxTail >= this.rxWaiter.count) {
+      const waiter = this.rxWaiter;
+      this.rxWaiter = null;
+      waiter.resolve();
+    }
+  }
+
+  /**
+   * Copy bytes from the ring buffer (without consuming them)
+   */
+  private copyInput(dest: Uint8Array, count: number): void {
+    const mask = this.rxBuffer.length - 1;
+    const start = this.rxTail & mask;
+    const first = Math.min(count, this.rxBuffer.length - start);
+    dest.set(this.rxBuffer.subarray(start, start + first), 0);
+    if (first < count) {
+      dest.set(this.rxBuffer.subarray(0, count - first), first);
+    }
+  }
+
+  /**
+   * Consume bytes from the ring buffer
+   */
+  private consumeInput(count: number): void {
+    this.rxTail += count;
+    if (this.rxTail === this.rxHead) {
+      // Keep the positions small so they never exceed the range of bitwise operations
+      this.discardInput();
+    }
+  }
+
+  /**
+   * Discard all received data
+   */
+  private discardInput(): void {
+    this.rxHead = 0;
+    this.rxTail = 0;
+  }
+
+  /**
+   * Wait until at least the given number of bytes have been received
+   * @param count number of bytes
+   * @param timeoutMs timeout in milliseconds
+   */
+  private async waitForInput(count: number, timeoutMs: number = this.timeout): Promise<void> {
+    if (this.rxHead - this.rxTail >= count) {
+      return;
+    }
+
+    let timer: ReturnType<typeof setTimeout> | undefined;
+    try {
+      await new Promise<void>((resolve, reject) => {
+        this.rxWaiter = { count, resolve };
+        timer = setTimeout(() => {
+          this.rxWaiter = null;
+          reject(new Error('Read timeout'));
+        }, timeoutMs);
+      });
     } finally {
-      tempReader.releaseLock();
+      clearTimeout(timer);
     }
   }
 
+  /**
+   * Get the baud rate currently in use
+   */
+  getBaud(): number {
+    return this.baud;
+  }
+
+  /**
+   * Change the baud rate. Web Serial can only do this by reopening the port.
+   * UPDI picks up the new rate from the SYNC character of the next frame.
+   * @param baud baud rate in bps to use from now on
+   */
+  async setBaud(baud: number): Promise<void> {
+    await this.closeSerial();
+    this.baud = baud;
+    await this.initialiseSerial();
+  }
+
   /**
    * Sends a char array to UPDI without inter-byte delay
    * Note that the byte will echo back
    * @param command command to send
    */
   async send(command: Uint8Array): Promise<void> {   
-    if (!this.port.writable) {
+    if (!this.writer) {
       throw new Error('Serial port writable stream is not available');
     }
-    
-    let writer = this.port.writable.getWriter();
+
+    await this.writer.write(command);
+
+    // Discard echo
     try {
-      await writer.write(command);
-      
-      // Read and discard echo
-      try {
-        await this.readWithTimeout(command.length);
-      } catch (e) {
-        throw new Error('No echo received for UPDI command: ' + e);
-      }
-    } finally {
-      writer.releaseLock();
+      await this.waitForInput(command.length);
+    } catch (e) {
+      throw new Error('No echo received for UPDI command: ' + e);
     }
+    this.consumeInput(command.length);
   }
 
   /**
@@ -137,7 +291,10 @@ export class UpdiPhysical {
    * @param size bytes to receive
    */
   async receive(size: number): Promise<Uint8Array> {
-    const data = await this.readWithTimeout(size);
+    await this.waitForInput(size);
+    const data = new Uint8Array(size);
+    this.copyInput(data, size);
+    this.consumeInput(size);
     return data;
   }
 
@@ -156,17 +313,18 @@ export class UpdiPhysical {
    * machine into a known state, albeit rather brutally
    */
   async sendBreak(): Promise<void> {
-    this.port.setSignals({ break: true });
+    await this.port.setSignals({ break: true });
     await this.sleep(25);
-    this.port.setSignals({ break: false });
+    await this.port.setSignals({ break: false });
     await this.sleep(1);
 
     // Flush input buffer
     try {
-      await this.readWithTimeout(1);
+      await this.waitForInput(1, BREAK_FLUSH_TIMEOUT);
     } catch (e) {
       // Ignore errors during flush
     }
+    this.discardInput();
   }
 
   /**
@@ -177,33 +335,18 @@ export class UpdiPhysical {
    */
   async sendDoubleBreak(): Promise<void> {
     for (let i = 0; i < 2; i++) {
-      this.sendBreak();
+      await this.sendBreak();
     }
   }
 
+  /**
+   * Stop reading and close the port
+   */
   async destroy(): Promise<void> {
-    if (this.port && this.port.readable) {
-      try {
-        await this.port.readable.cancel();
-      } catch (e) {
-        // Stream might already be canceled
-      }
-    }
-
-    if (this.port && this.port.writable) {
-      try {
-        await this.port.writable.abort();
-      } catch (e) {
-        // Stream might already be aborted
-      }
-    }
-
-    if (this.port) {
-      try {
-        await this.port.close();
-      } catch (e) {
-        // Ignore
-      }
+    try {
+      await this.closeSerial();
+    } catch (e) {
+      // Ignore
     }
   }
 
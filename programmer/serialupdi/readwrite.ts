@@ -11,9 +11,16 @@ import { UpdiDatalink } from "./link.js";
  */
 export class UpdiReadWrite {
   private datalink: UpdiDatalink;
+  burstWrites: boolean;
 
-  constructor(datalink: UpdiDatalink) {
+  /**
+   * @param datalink datalink to use
+   * @param burstWrites True to write blocks as a single ACK-less burst, False to use the
+   * slower ACK-checked path (useful for debugging)
+   */
+  constructor(datalink: UpdiDatalink, burstWrites: boolean = true) {
     this.datalink = datalink;
+    this.burstWrites = burstWrites;
   }
 
   /**
@@ -141,6 +148,11 @@ export class UpdiReadWrite {
       );
     }
 
+    if (this.burstWrites) {
+      await this.datalink.stBurst(address, data, true);
+      return;
+    }
+
     // Store the address
     await this.datalink.stPtr(address);
 
@@ -179,12 +191,16 @@ export class UpdiReadWrite {
         chunkSize = numbytes;
       }
 
-      // Store the address
-      await this.datalink.stPtr(address);
+      if (this.burstWrites) {
+        await this.datalink.stBurst(address, data.subarray(index, index + chunkSize), false);
+      } else {
+        // Store the address
+        await this.datalink.stPtr(address);
 
-      // Fire up the repeat
-      await this.datalink.repeat(chunkSize);
-      await this.datalink.stPtrInc(data.slice(index, index + chunkSize));
+        // Fire up the repeat
+        await this.datalink.repeat(chunkSize);
+        await this.datalink.stPtrInc(data.slice(index, index + chunkSize));
+      }
 
       index += chunkSize;
       address += chunkSize;
@@ -0,0 +1,220 @@
+/**
+ * Firmware telemetry decoder
+ * Decodes the telemetry block that the firmware keeps at a fixed SRAM address (see
+ * firmware/src/telemetry.h), which can be read over UPDI while the firmware is running.
+ */
+
+export const TELEMETRY_ADDRESS = 0x3F80;    // must match the firmware Makefile
+export const TELEMETRY_SIZE = 0x80;         // space reserved for the block
+
+const TELEMETRY_MAGIC = 0x4B54;
+const TELEMETRY_VERSION = 1;
+const TELEMETRY_FAULT_HISTORY = 4;
+const TELEMETRY_HEADER_SIZE = 4;            // magic, version, size
+const TELEMETRY_FAULT_SIZE = 7;
+const TICKS_PER_SECOND = 1024;
+
+// Byte offsets in the block (version 1)
+const OFFSET_SEQ_HEAD = 4;
+const OFFSET_RESET_FLAGS = 5;
+const OFFSET_WARM_RESETS = 6;
+const OFFSET_PD_CONN_STATE = 7;
+const OFFSET_PD_POLICY_STATE = 8;
+const OFFSET_THERMAL_DERATING = 9;
+const OFFSET_WAKES = 10;
+const OFFSET_TICKS = 12;
+const OFFSET_ADC = 16;
+const OFFSET_CHARGER = 32;
+const OFFSET_FAULT_COUNT = 45;
+const OFFSET_FAULTS = 46;
+const TELEMETRY_BLOCK_SIZE = 75;
+
+export interface TelemetryFault {
+    status: number;             // charger fault status bits
+    state: number;              // charger state in which the fault occurred
+    uptime: number;             // s
+}
+
+export interface TelemetrySample {
+    sequence: number;           // changes with every update
+    resetFlags: number;         // RSTCTRL.RSTFR
+    warmResets: number;
+    pdConnState: number;
+    pdPolicyState: number;
+    thermalDerating: number;    // %
+    wakes: number;              // wraps around at 65536
+    uptime: number;             // s
+    vbus: number;               // mV
+    vac1: number;               // mV
+    vac2: number;               // mV
+    ibus: number;               // mA
+    vbat: number;               // mV
+    ibat: number;               // mA
+    tdie: number;               // °C
+    ts: number;                 // thermistor reading, 0..1023
+    chargerState: number;
+    preFaultState: number;
+    otgVoltage: number;         // mV
+    otgCurrent: number;         // mA
+    otgCompensation: number;    // mV
+    otgPathResistance: number;  // mOhm
+    dischargingLowBattery: boolean;
+    faultRetryCount: number;
+    faultSeconds: number;
+    faultCount: number;
+    faults: TelemetryFault[];   // most recent first
+}
+
+// Charger states (ChargerState in charger_sm.h)
+export const CHARGER_STATE_NAMES = [
+    'Disconnected', 'USB negotiating', 'USB Type-C charging', 'USB PD charging', 'DC charging',
+    'Rig on', 'Discharging', 'Discharging blocked', 'Fault',
+];
+
+// Type-C connection states and PD policy states of the FSC PD reference code (see firmware README)
+export const PD_CONN_STATE_NAMES = [
+    'Disabled', 'ErrorRecovery', 'Unattached', 'AttachWaitSink', 'AttachedSink', 'AttachWaitSource',
+    'AttachedSource', 'TrySource', 'TryWaitSink', 'TrySink', 'TryWaitSource', 'AudioAccessory',
+    'DebugAccessorySource', 'AttachWaitAccessory', 'PoweredAccessory', 'UnsupportedAccessory',
+    'DelayUnattached', 'UnattachedSource', 'DebugAccessorySink', 'AttachWaitDebSink',
+    'AttachedDebSink', 'AttachWaitDebSource', 'AttachedDebSource', 'TryDebSource', 'TryWaitDebSink',
+    'UnattachedDebSource', 'IllegalCable', 'UnattachedSourceOnly',
+];
+
+export const PD_POLICY_STATE_NAMES = [
+    'peDisabled', 'peErrorRecovery', 'peSourceHardReset', 'peSourceSendHardReset',
+    'peSourceSoftReset', 'peSourceSendSoftReset', 'peSourceStartup', 'peSourceSendCaps',
+    'peSourceDiscovery', 'peSourceDisabled', 'peSourceTransitionDefault', 'peSourceNegotiateCap',
+    'peSourceCapabilityResponse', 'peSourceWaitNewCapabilities', 'peSourceTransitionSupply',
+    'peSourceReady', 'peSourceGiveSourceCaps', 'peSourceGetSinkCaps', 'peSourceSendPing',
+    'peSourceGotoMin', 'peSourceGiveSinkCaps', 'peSourceGetSourceCaps', 'peSourceSendDRSwap',
+    'peSourceEvaluateDRSwap', 'peSourceAlertReceived', 'peSinkHardReset', 'peSinkSendHardReset',
+    'peSinkSoftReset', 'peSinkSendSoftReset', 'peSinkTransitionDefault', 'peSinkStartup',
+    'peSinkDiscovery', 'peSinkWaitCaps', 'peSinkEvaluateCaps', 'peSinkSelectCapability',
+    'peSinkTransitionSink', 'peSinkReady', 'peSinkGiveSinkCap', 'peSinkGetSourceCap',
+    'peSinkGetSinkCap', 'peSinkGiveSourceCap', 'peSinkSendDRSwap', 'peSinkAlertReceived',
+    'peSinkEvaluateDRSwap', 'peSourceSendVCONNSwap', 'peSourceEvaluateVCONNSwap',
+    'peSinkSendVCONNSwap', 'peSinkEvaluateVCONNSwap', 'peSourceSendPRSwap',
+    'peSourceEvaluatePRSwap', 'peSinkSendPRSwap', 'peSinkEvaluatePRSwap', 'peGetCountryCodes',
+    'peGiveCountryCodes', 'peNotSupported', 'peGetPPSStatus', 'peGivePPSStatus',
+    'peGiveCountryInfo', 'peGiveVdm', 'peUfpVdmGetIdentity', 'peUfpVdmSendIdentity',
+    'peUfpVdmGetSvids', 'peUfpVdmSendSvids', 'peUfpVdmGetModes', 'peUfpVdmSendModes',
+    'peUfpVdmEvaluateModeEntry', 'peUfpVdmModeEntryNak', 'peUfpVdmModeEntryAck', 'peUfpVdmModeExit',
+    'peUfpVdmModeExitNak', 'peUfpVdmModeExitAck', 'peUfpVdmAttentionRequest',
+    'peDfpUfpVdmIdentityRequest', 'peDfpUfpVdmIdentityAcked', 'peDfpUfpVdmIdentityNaked',
+    'peDfpCblVdmIdentityRequest', 'peDfpCblVdmIdentityAcked', 'peDfpCblVdmIdentityNaked',
+    'peDfpVdmSvidsRequest', 'peDfpVdmSvidsAcked', 'peDfpVdmSvidsNaked', 'peDfpVdmModesRequest',
+    'peDfpVdmModesAcked', 'peDfpVdmModesNaked', 'peDfpVdmModeEntryRequest',
+    'peDfpVdmModeEntryAcked', 'peDfpVdmModeEntryNaked', 'peDfpVdmModeExitRequest',
+    'peDfpVdmExitModeAcked', 'peSrcVdmIdentityRequest', 'peSrcVdmIdentityAcked',
+    'peSrcVdmIdentityNaked', 'peDfpVdmAttentionRequest', 'peCblReady', 'peCblGetIdentity',
+    'peCblGetIdentityNak', 'peCblSendIdentity', 'peCblGetSvids', 'peCblGetSvidsNak',
+    'peCblSendSvids', 'peCblGetModes', 'peCblGetModesNak', 'peCblSendModes',
+    'peCblEvaluateModeEntry', 'peCblModeEntryAck', 'peCblModeEntryNak', 'peCblModeExit',
+    'peCblModeExitAck', 'peCblModeExitNak', 'peDpRequestStatus', 'peDpRequestStatusAck',
+    'peDpRequestStatusNak', 'peDpRequestConfig', 'peDpRequestConfigAck', 'peDpRequestConfigNak',
+    'PE_BIST_Receive_Mode', 'PE_BIST_Frame_Received', 'PE_BIST_Carrier_Mode_2', 'PE_BIST_Test_Data',
+    'dbgGetRxPacket', 'dbgSendTxPacket', 'peSendCableReset', 'peSendGenericCommand',
+    'peSendGenericData',
+];
+
+// Charger fault status bits (FaultStatus in bq.h)
+const FAULT_NAMES: [number, string][] = [
+    [0x0004, 'TSHUT'], [0x0010, 'OTG_UVP'], [0x0040, 'VSYS_OVP'], [0x0080, 'VSYS_SHORT'],
+    [0x0100, 'VAC1_OVP'], [0x0200, 'VAC2_OVP'], [0x0400, 'CONV_OCP'], [0x0800, 'IBAT_OCP'],
+    [0x1000, 'IBUS_OCP'], [0x2000, 'VBAT_OVP'], [0x4000, 'VBUS_OVP'],
+];
+
+// Reset flags (RSTCTRL.RSTFR)
+const RESET_FLAG_NAMES = ['power-on', 'brown-out', 'external', 'watchdog', 'software', 'UPDI'];
+
+/**
+ * Look up the name of a state
+ */
+export function stateName(names: string[], state: number): string {
+    return names[state] ?? `Unknown (${state})`;
+}
+
+/**
+ * Format charger fault status bits
+ */
+export function formatFaultStatus(status: number): string {
+    const names = FAULT_NAMES.filter(([bit]) => status & bit).map(([, name]) => name);
+    return names.length > 0 ? names.join(', ') : 'none';
+}
+
+/**
+ * Format reset flags
+ */
+export function formatResetFlags(flags: number): string {
+    const names = RESET_FLAG_NAMES.filter((_, bit) => flags & (1 << bit));
+    return names.length > 0 ? names.join(', ') : 'none';
+}
+
+/**
+ * Decode the telemetry block
+ * @param bytes block as read from TELEMETRY_ADDRESS (TELEMETRY_SIZE bytes)
+ * @returns decoded sample, or null if the firmware was updating the block while it was read
+ * @throws Error if there is no telemetry block of a supported version
+ */
+export function decodeTelemetry(bytes: Uint8Array): TelemetrySample | null {
+    if (bytes.length < TELEMETRY_HEADER_SIZE) {
+        throw new Error(`Invalid telemetry data: expected ${TELEMETRY_SIZE} bytes, got ${bytes.length}`);
+    }
+    const view = new DataView(bytes.buffer, bytes.byteOffset, bytes.byteLength);
+    if (view.getUint16(0, true) !== TELEMETRY_MAGIC) {
+        throw new Error('No telemetry found (firmware without telemetry support, or not running)');
+    }
+    const version = bytes[2];
+    const size = bytes[3];
+    if (version !== TELEMETRY_VERSION || size !== TELEMETRY_BLOCK_SIZE || bytes.length < size) {
+        throw new Error(`Unsupported telemetry version ${version} (size ${size})`);
+    }
+
+    // The sequence counters at both ends of the block differ while an update is in progress
+    const sequence = bytes[OFFSET_SEQ_HEAD];
+    if (bytes[size - 1] !== sequence) {
+        return null;
+    }
+
+    const faultCount = bytes[OFFSET_FAULT_COUNT];
+    const faults: TelemetryFault[] = [];
+    for (let i = 1; i <= Math.min(faultCount, TELEMETRY_FAULT_HISTORY); i++) {
+        const offset = OFFSET_FAULTS + ((faultCount - i) % TELEMETRY_FAULT_HISTORY) * TELEMETRY_FAULT_SIZE;
+        faults.push({
+            status: view.getUint16(offset, true),
+            state: bytes[offset + 2],
+            uptime: view.getUint32(offset + 3, true) / TICKS_PER_SECOND,
+        });
+    }
+
+    return {
+        sequence,
+        resetFlags: bytes[OFFSET_RESET_FLAGS],
+        warmResets: bytes[OFFSET_WARM_RESETS],
+        pdConnState: bytes[OFFSET_PD_CONN_STATE],
+        pdPolicyState: bytes[OFFSET_PD_POLICY_STATE],
+        thermalDerating: bytes[OFFSET_THERMAL_DERATING],
+        wakes: view.getUint16(OFFSET_WAKES, true),
+        uptime: view.getUint32(OFFSET_TICKS, true) / TICKS_PER_SECOND,
+        vbus: view.getUint16(OFFSET_ADC, true),
+        vac1: view.getUint16(OFFSET_ADC + 2, true),
+        vac2: view.getUint16(OFFSET_ADC + 4, true),
+        ibus: view.getInt16(OFFSET_ADC + 6, true),
+        vbat: view.getUint16(OFFSET_ADC + 8, true),
+        ibat: view.getInt16(OFFSET_ADC + 10, true),
+        tdie: view.getInt16(OFFSET_ADC + 12, true) / 2,
+        ts: view.getUint16(OFFSET_ADC + 14, true),
+        chargerState: bytes[OFFSET_CHARGER],
+        preFaultState: bytes[OFFSET_CHARGER + 1],
+        otgVoltage: view.getUint16(OFFSET_CHARGER + 2, true),
+        otgCurrent: view.getUint16(OFFSET_CHARGER + 4, true),
+        otgCompensation: view.getUint16(OFFSET_CHARGER + 6, true),
+        otgPathResistance: bytes[OFFSET_CHARGER + 8],
+        dischargingLowBattery: bytes[OFFSET_CHARGER + 9] !== 0,
+        faultRetryCount: bytes[OFFSET_CHARGER + 10],
+        faultSeconds: view.getUint16(OFFSET_CHARGER + 11, true),
+        faultCount,
+        faults,
+    };
+}
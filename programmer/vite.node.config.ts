@@ -0,0 +1,16 @@
+import { defineConfig } from 'vite';
+
+// Command line programmer for Node.js (see node/cli.ts)
+export default defineConfig({
+  build: {
+    ssr: 'node/cli.ts',
+    outDir: 'dist-node',
+    emptyOutDir: true,
+    target: 'node18',
+    minify: false,
+    rollupOptions: {
+      // Optional, only needed for hardware access
+      external: ['serialport'],
+    },
+  },
+});